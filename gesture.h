@@ -0,0 +1,249 @@
+// KCTRL 手势识别引擎
+// 按(设备槽位, 按键码)维护按键状态，把按下/释放事件识别为单击、双击、短按与长按，识别前先做时间戳去抖
+// 时钟、定时器与分发由模板参数注入，引擎不访问全局变量、不含虚函数，热路径可以完全内联：
+// kctrl用内核事件时间、事件循环的timerfd与动作队列实例化，kctrl --bench-gesture用虚拟时钟与记录分发实例化
+#ifndef KCTRL_GESTURE_H
+#define KCTRL_GESTURE_H
+
+#include <stdint.h>
+#include <iterator>
+#include <unordered_map>
+
+// 手势编号（FR_CLASSIFY/FR_DISPATCH的value）
+enum GestureId : int32_t {
+    GESTURE_CLICK = 0,
+    GESTURE_DOUBLE_CLICK = 1,
+    GESTURE_SHORT_PRESS = 2,
+    GESTURE_LONG_PRESS = 3,
+    GESTURE_CLICK_PENDING = 4,  // 点击已计数，等待双击窗口结束
+};
+
+// 手势时间参数（毫秒）：按下时长<=click为点击，>=long为长按，其间为短按；
+// 点击后等待double毫秒判断单击/双击，0表示不等待第二次点击，释放时立即分发单击；
+// 释放后debounce毫秒内的再次按下视为触点抖动，0表示不去抖
+#define TIMING_UNSET 0xFFFF  // 按键/设备级参数中未设置的字段，沿用上一级
+struct GestureTiming {
+    uint16_t click_ms;
+    uint16_t long_ms;
+    uint16_t double_ms;
+    uint16_t debounce_ms;
+};
+
+// 按键状态结构体 - 极致内存优化版本
+// 仅由事件循环线程访问，无需加锁；按(设备, 按键码)分别记录，不同设备的同一按键互不干扰
+template <typename Device>
+struct GestureKeyState {
+    uint64_t press_time_ns;      // 纳秒时间戳（内核事件时间，CLOCK_MONOTONIC），8字节
+    uint64_t last_click_time_ns; // 纳秒时间戳，8字节
+    uint64_t click_deadline_ns;  // 双击窗口截止时间，8字节
+    uint64_t release_time_ns;    // 最近一次释放（含被去抖丢弃的释放）的时间，8字节
+    const Device* device;        // 按键所在设备，8字节
+    uint32_t last_duration_ms;   // 最近一次按压时长，4字节
+    uint8_t flags;               // 位域：bit0=is_pressed, bit1=timer_active, bit2-6=click_count, bit7=swallow_release
+
+    GestureKeyState() : press_time_ns(0), last_click_time_ns(0), click_deadline_ns(0), release_time_ns(0),
+                        device(nullptr), last_duration_ms(0), flags(0) {}
+
+    inline bool is_pressed() const { return flags & 1; }
+    inline void set_pressed(bool pressed) {
+        flags = pressed ? (flags | 1) : (flags & 0xFE);
+    }
+    inline bool timer_active() const { return flags & 2; }
+    inline void set_timer_active(bool active) {
+        flags = active ? (flags | 2) : (flags & 0xFD);
+    }
+    inline uint8_t click_count() const { return (flags >> 2) & 0x1F; }
+    inline void set_click_count(uint8_t count) {
+        flags = (flags & 0x83) | ((count & 0x1F) << 2);
+    }
+    // 被去抖丢弃的按下：与之配对的释放也一并丢弃
+    inline bool swallow_release() const { return flags & 0x80; }
+    inline void set_swallow_release(bool swallow) {
+        flags = swallow ? (flags | 0x80) : (flags & 0x7F);
+    }
+};
+
+// 策略（按成员函数约定，不要求继承）：
+//   Device     须有 uint16_t slot 成员，与按键码组成按键状态的键
+//   Clock      uint64_t now_ns()                          定时器到期时的当前时间，与事件时间同一时钟
+//   Timer      void arm(uint64_t deadline_ns)             按绝对时间设置唯一的双击窗口定时器，0表示解除
+//   Dispatcher GestureTiming timing(const Device&, uint16_t code)      该按键生效的时间参数
+//              void dispatch(uint16_t code, GestureId, uint32_t duration_ms, uint8_t clicks,
+//                            uint64_t time_ns, uint64_t due_ns, const Device*)  手势确定，due_ns为确定的时刻
+//              void pressed(uint16_t code)
+//              void classified(uint16_t code, int32_t gesture, uint32_t duration_ms, uint64_t time_ns)
+//              void timer_fired(uint16_t code, uint8_t clicks)
+//              void bounced(uint16_t code, bool merged, uint64_t gap_ns, uint64_t time_ns)
+//              void busy(bool)                            有按键按下或双击窗口未关闭（手势唤醒锁）
+template <typename Device, typename Clock, typename Timer, typename Dispatcher>
+class GestureEngine {
+public:
+    using KeyState = GestureKeyState<Device>;
+    using StateMap = std::unordered_map<uint32_t, KeyState>;
+
+    GestureEngine() = default;
+    GestureEngine(const Clock& clock, const Timer& timer, const Dispatcher& dispatcher)
+        : clock_(clock), timer_(timer), dispatcher_(dispatcher) {}
+
+    static inline uint32_t state_id(uint16_t slot, uint16_t code) { return (static_cast<uint32_t>(slot) << 16) | code; }
+    static inline uint16_t state_code(uint32_t id) { return static_cast<uint16_t>(id & 0xFFFF); }
+
+    Clock& clock() { return clock_; }
+    Timer& timer() { return timer_; }
+    Dispatcher& dispatcher() { return dispatcher_; }
+    StateMap& states() { return states_; }
+    const StateMap& states() const { return states_; }
+
+    // 按键事件：value为1按下、0释放，其余（自动重复）忽略；event_ns为内核事件时间
+    // 去抖只比较事件时间戳：释放后debounce内的按下视为触点抖动，
+    // 上次释放若是仍在双击窗口中的点击则撤销该点击、按原来的按压继续计时，否则丢弃这次按下及其释放
+    void key_event(const Device& dev, uint16_t code, int32_t value, uint64_t event_ns) {
+        if (value == 1) {
+            KeyState& state = states_[state_id(dev.slot, code)];
+            if (!state.is_pressed() && state.release_time_ns != 0 && debounce_press(dev, code, state, event_ns)) {
+                update_busy();
+                return;
+            }
+
+            state.set_swallow_release(false);
+            state.set_pressed(true);
+            state.press_time_ns = event_ns;
+            state.device = &dev;
+            dispatcher_.pressed(code);
+            // 按下时不触发任何脚本，等待释放时判断事件类型
+        } else if (value == 0) {
+            // 未记录按下的释放直接忽略，不创建状态
+            auto found = states_.find(state_id(dev.slot, code));
+            if (found == states_.end()) return;
+            KeyState& state = found->second;
+            GestureTiming timing = dispatcher_.timing(dev, code);
+
+            if (state.swallow_release()) {
+                // 被丢弃的抖动按下所对应的释放，顺延去抖窗口以覆盖连续抖动
+                state.set_swallow_release(false);
+                state.release_time_ns = event_ns;
+            } else if (state.is_pressed()) {
+                release(code, state, timing, event_ns);
+            }
+            // 没有未关闭的双击窗口时移除状态；开启去抖的按键保留状态以记住释放时间
+            if (!state.is_pressed() && !state.timer_active() && timing.debounce_ms == 0) states_.erase(found);
+        } else {
+            return;
+        }
+        update_busy();
+    }
+
+    // 双击窗口定时器到期：判定所有已到期按键的单击/双击
+    void timer_expired() {
+        uint64_t now_ns = clock_.now_ns();
+        for (auto it = states_.begin(); it != states_.end();) {
+            uint16_t code = state_code(it->first);
+            KeyState& state = it->second;
+            if (!state.timer_active() || state.click_deadline_ns > now_ns) {
+                ++it;
+                continue;
+            }
+
+            uint8_t click_count = state.click_count();
+            dispatcher_.timer_fired(code, click_count);
+            state.set_click_count(0);
+            state.set_timer_active(false);
+
+            if (click_count >= 1) {
+                dispatcher_.dispatch(code, click_count == 1 ? GESTURE_CLICK : GESTURE_DOUBLE_CLICK,
+                                     state.last_duration_ms, click_count, state.last_click_time_ns,
+                                     state.click_deadline_ns, state.device);
+            }
+            // 手势结束且按键未按下时移除状态，避免按过的按键长期占用表项
+            it = state.is_pressed() ? std::next(it) : states_.erase(it);
+        }
+        rearm();
+        update_busy();
+    }
+
+    // 按所有按键中最早的双击窗口截止时间重新设置定时器
+    void rearm() {
+        uint64_t earliest_ns = 0;
+        for (const auto& pair : states_) {
+            const KeyState& state = pair.second;
+            if (state.timer_active() && (earliest_ns == 0 || state.click_deadline_ns < earliest_ns)) {
+                earliest_ns = state.click_deadline_ns;
+            }
+        }
+        timer_.arm(earliest_ns);
+    }
+
+    // 有按键按下或双击窗口未关闭时为忙，变化时通知分发策略
+    void update_busy() {
+        bool busy = false;
+        for (const auto& pair : states_) {
+            if (pair.second.is_pressed() || pair.second.timer_active()) {
+                busy = true;
+                break;
+            }
+        }
+        if (busy == busy_) return;
+        busy_ = busy;
+        dispatcher_.busy(busy);
+    }
+
+private:
+    // 释放时按时长分类
+    void release(uint16_t code, KeyState& state, const GestureTiming& timing, uint64_t event_ns) {
+        state.set_pressed(false);
+        state.release_time_ns = event_ns;
+        uint32_t duration = static_cast<uint32_t>((event_ns - state.press_time_ns) / 1000000); // 转换为毫秒
+        state.last_duration_ms = duration;
+
+        bool immediate_click = timing.double_ms == 0 && !state.timer_active();
+        int32_t gesture = (duration > timing.click_ms) ?
+                          (duration >= timing.long_ms ? GESTURE_LONG_PRESS : GESTURE_SHORT_PRESS) :
+                          (immediate_click ? GESTURE_CLICK : GESTURE_CLICK_PENDING);
+        dispatcher_.classified(code, gesture, duration, event_ns);
+        if (gesture == GESTURE_CLICK_PENDING) {
+            // 点击事件 - 打开双击窗口，到期后由定时器判断单击/双击
+            state.set_click_count(state.click_count() + 1);
+            state.last_click_time_ns = event_ns;
+
+            if (!state.timer_active()) {
+                state.set_timer_active(true);
+                state.click_deadline_ns = event_ns + static_cast<uint64_t>(timing.double_ms) * 1000000ULL;
+                rearm();
+            }
+        } else {
+            // 不等待双击的单击、短按与长按在释放时直接分发（按键释放时不触发keyup事件）
+            dispatcher_.dispatch(code, static_cast<GestureId>(gesture), duration, gesture == GESTURE_CLICK ? 1 : 0,
+                                 event_ns, event_ns, state.device);
+        }
+    }
+
+    // 按下是否为抖动，是则已处理完毕
+    bool debounce_press(const Device& dev, uint16_t code, KeyState& state, uint64_t event_ns) {
+        GestureTiming timing = dispatcher_.timing(dev, code);
+        uint64_t gap_ns = event_ns - state.release_time_ns;
+        if (gap_ns >= static_cast<uint64_t>(timing.debounce_ms) * 1000000ULL) return false;
+
+        bool merge = !state.swallow_release() && state.timer_active() && state.click_count() > 0 &&
+                     state.last_click_time_ns == state.release_time_ns;
+        if (merge) {
+            state.set_click_count(state.click_count() - 1);
+            state.set_pressed(true);
+            if (state.click_count() == 0) {
+                state.set_timer_active(false);
+                rearm();
+            }
+        } else {
+            state.set_swallow_release(true);
+        }
+        dispatcher_.bounced(code, merge, gap_ns, event_ns);
+        return true;
+    }
+
+    Clock clock_;
+    Timer timer_;
+    Dispatcher dispatcher_;
+    StateMap states_;
+    bool busy_ = false;
+};
+
+#endif // KCTRL_GESTURE_H
@@ -0,0 +1,251 @@
+// KCTRL 按键码名称表
+// 覆盖 linux/input-event-codes.h 中全部 KEY_* 与 BTN_* 定义：KEY_ 去掉前缀（VOLUMEUP），BTN_ 保留前缀（BTN_LEFT）
+// 表按名称排序并在编译期校验，按名称二分查找；按键码到名称的直接索引表也在编译期生成
+// 查找均不分配内存，由kctrl与kfind共用
+#ifndef KCTRL_KEYCODES_H
+#define KCTRL_KEYCODES_H
+
+#include <linux/input.h>
+#include <stdint.h>
+#include <string_view>
+
+struct KeyName {
+    std::string_view name;
+    uint16_t code;
+    bool primary;   // 同一按键码有多个名称时，按键码到名称取primary的那个（别名为false）
+};
+
+// 按键码以数值写出，不依赖NDK头文件中是否已有较新的定义
+// 新增条目须保持按名称（字节序）排序，否则编译失败
+inline constexpr KeyName g_key_names[] = {
+    { "0", 11, true }, { "1", 2, true }, { "102ND", 86, true }, { "10CHANNELSDOWN", 441, true },
+    { "10CHANNELSUP", 440, true }, { "2", 3, true }, { "3", 4, true }, { "3D_MODE", 623, true }, { "4", 5, true },
+    { "5", 6, true }, { "6", 7, true }, { "7", 8, true }, { "8", 9, true }, { "9", 10, true }, { "A", 30, true },
+    { "AB", 406, true }, { "ADDRESSBOOK", 429, true }, { "AGAIN", 129, true }, { "ALL_APPLICATIONS", 204, true },
+    { "ALS_TOGGLE", 560, true }, { "ALTERASE", 222, true }, { "ANGLE", 371, true }, { "APOSTROPHE", 40, true },
+    { "APPSELECT", 580, true }, { "ARCHIVE", 361, true }, { "ASPECT_RATIO", 375, true }, { "ASSISTANT", 583, true },
+    { "ATTENDANT_OFF", 540, true }, { "ATTENDANT_ON", 539, true }, { "ATTENDANT_TOGGLE", 541, true },
+    { "AUDIO", 392, true }, { "AUDIO_DESC", 622, true }, { "AUTOPILOT_ENGAGE_TOGGLE", 637, true },
+    { "AUX", 390, true }, { "B", 48, true }, { "BACK", 158, true }, { "BACKSLASH", 43, true },
+    { "BACKSPACE", 14, true }, { "BASSBOOST", 209, true }, { "BATTERY", 236, true }, { "BLUE", 401, true },
+    { "BLUETOOTH", 237, true }, { "BOOKMARKS", 156, true }, { "BREAK", 411, true }, { "BRIGHTNESSDOWN", 224, true },
+    { "BRIGHTNESSUP", 225, true }, { "BRIGHTNESS_AUTO", 244, true }, { "BRIGHTNESS_CYCLE", 243, true },
+    { "BRIGHTNESS_MAX", 593, true }, { "BRIGHTNESS_MENU", 649, true }, { "BRIGHTNESS_MIN", 592, true },
+    { "BRIGHTNESS_TOGGLE", 431, false }, { "BRIGHTNESS_ZERO", 244, false }, { "BRL_DOT1", 497, true },
+    { "BRL_DOT10", 506, true }, { "BRL_DOT2", 498, true }, { "BRL_DOT3", 499, true }, { "BRL_DOT4", 500, true },
+    { "BRL_DOT5", 501, true }, { "BRL_DOT6", 502, true }, { "BRL_DOT7", 503, true }, { "BRL_DOT8", 504, true },
+    { "BRL_DOT9", 505, true }, { "BTN_0", 256, true }, { "BTN_1", 257, true }, { "BTN_2", 258, true },
+    { "BTN_3", 259, true }, { "BTN_4", 260, true }, { "BTN_5", 261, true }, { "BTN_6", 262, true },
+    { "BTN_7", 263, true }, { "BTN_8", 264, true }, { "BTN_9", 265, true }, { "BTN_A", 304, false },
+    { "BTN_B", 305, false }, { "BTN_BACK", 278, true }, { "BTN_BASE", 294, true }, { "BTN_BASE2", 295, true },
+    { "BTN_BASE3", 296, true }, { "BTN_BASE4", 297, true }, { "BTN_BASE5", 298, true }, { "BTN_BASE6", 299, true },
+    { "BTN_C", 306, true }, { "BTN_DEAD", 303, true }, { "BTN_DIGI", 320, false }, { "BTN_DPAD_DOWN", 545, true },
+    { "BTN_DPAD_LEFT", 546, true }, { "BTN_DPAD_RIGHT", 547, true }, { "BTN_DPAD_UP", 544, true },
+    { "BTN_EAST", 305, true }, { "BTN_EXTRA", 276, true }, { "BTN_FORWARD", 277, true },
+    { "BTN_GAMEPAD", 304, false }, { "BTN_GEAR_DOWN", 336, true }, { "BTN_GEAR_UP", 337, true },
+    { "BTN_JOYSTICK", 288, false }, { "BTN_LEFT", 272, true }, { "BTN_MIDDLE", 274, true },
+    { "BTN_MISC", 256, false }, { "BTN_MODE", 316, true }, { "BTN_MOUSE", 272, false }, { "BTN_NORTH", 307, true },
+    { "BTN_PINKIE", 293, true }, { "BTN_RIGHT", 273, true }, { "BTN_SELECT", 314, true }, { "BTN_SIDE", 275, true },
+    { "BTN_SOUTH", 304, true }, { "BTN_START", 315, true }, { "BTN_STYLUS", 331, true }, { "BTN_STYLUS2", 332, true },
+    { "BTN_STYLUS3", 329, true }, { "BTN_TASK", 279, true }, { "BTN_THUMB", 289, true }, { "BTN_THUMB2", 290, true },
+    { "BTN_THUMBL", 317, true }, { "BTN_THUMBR", 318, true }, { "BTN_TL", 310, true }, { "BTN_TL2", 312, true },
+    { "BTN_TOOL_AIRBRUSH", 324, true }, { "BTN_TOOL_BRUSH", 322, true }, { "BTN_TOOL_DOUBLETAP", 333, true },
+    { "BTN_TOOL_FINGER", 325, true }, { "BTN_TOOL_LENS", 327, true }, { "BTN_TOOL_MOUSE", 326, true },
+    { "BTN_TOOL_PEN", 320, true }, { "BTN_TOOL_PENCIL", 323, true }, { "BTN_TOOL_QUADTAP", 335, true },
+    { "BTN_TOOL_QUINTTAP", 328, true }, { "BTN_TOOL_RUBBER", 321, true }, { "BTN_TOOL_TRIPLETAP", 334, true },
+    { "BTN_TOP", 291, true }, { "BTN_TOP2", 292, true }, { "BTN_TOUCH", 330, true }, { "BTN_TR", 311, true },
+    { "BTN_TR2", 313, true }, { "BTN_TRIGGER", 288, true }, { "BTN_TRIGGER_HAPPY", 704, false },
+    { "BTN_TRIGGER_HAPPY1", 704, true }, { "BTN_TRIGGER_HAPPY10", 713, true }, { "BTN_TRIGGER_HAPPY11", 714, true },
+    { "BTN_TRIGGER_HAPPY12", 715, true }, { "BTN_TRIGGER_HAPPY13", 716, true }, { "BTN_TRIGGER_HAPPY14", 717, true },
+    { "BTN_TRIGGER_HAPPY15", 718, true }, { "BTN_TRIGGER_HAPPY16", 719, true }, { "BTN_TRIGGER_HAPPY17", 720, true },
+    { "BTN_TRIGGER_HAPPY18", 721, true }, { "BTN_TRIGGER_HAPPY19", 722, true }, { "BTN_TRIGGER_HAPPY2", 705, true },
+    { "BTN_TRIGGER_HAPPY20", 723, true }, { "BTN_TRIGGER_HAPPY21", 724, true }, { "BTN_TRIGGER_HAPPY22", 725, true },
+    { "BTN_TRIGGER_HAPPY23", 726, true }, { "BTN_TRIGGER_HAPPY24", 727, true }, { "BTN_TRIGGER_HAPPY25", 728, true },
+    { "BTN_TRIGGER_HAPPY26", 729, true }, { "BTN_TRIGGER_HAPPY27", 730, true }, { "BTN_TRIGGER_HAPPY28", 731, true },
+    { "BTN_TRIGGER_HAPPY29", 732, true }, { "BTN_TRIGGER_HAPPY3", 706, true }, { "BTN_TRIGGER_HAPPY30", 733, true },
+    { "BTN_TRIGGER_HAPPY31", 734, true }, { "BTN_TRIGGER_HAPPY32", 735, true }, { "BTN_TRIGGER_HAPPY33", 736, true },
+    { "BTN_TRIGGER_HAPPY34", 737, true }, { "BTN_TRIGGER_HAPPY35", 738, true }, { "BTN_TRIGGER_HAPPY36", 739, true },
+    { "BTN_TRIGGER_HAPPY37", 740, true }, { "BTN_TRIGGER_HAPPY38", 741, true }, { "BTN_TRIGGER_HAPPY39", 742, true },
+    { "BTN_TRIGGER_HAPPY4", 707, true }, { "BTN_TRIGGER_HAPPY40", 743, true }, { "BTN_TRIGGER_HAPPY5", 708, true },
+    { "BTN_TRIGGER_HAPPY6", 709, true }, { "BTN_TRIGGER_HAPPY7", 710, true }, { "BTN_TRIGGER_HAPPY8", 711, true },
+    { "BTN_TRIGGER_HAPPY9", 712, true }, { "BTN_WEST", 308, true }, { "BTN_WHEEL", 336, false },
+    { "BTN_X", 307, false }, { "BTN_Y", 308, false }, { "BTN_Z", 309, true }, { "BUTTONCONFIG", 576, true },
+    { "C", 46, true }, { "CALC", 140, true }, { "CALENDAR", 397, true }, { "CAMERA", 212, true },
+    { "CAMERA_DOWN", 536, true }, { "CAMERA_FOCUS", 528, true }, { "CAMERA_LEFT", 537, true },
+    { "CAMERA_RIGHT", 538, true }, { "CAMERA_UP", 535, true }, { "CAMERA_ZOOMIN", 533, true },
+    { "CAMERA_ZOOMOUT", 534, true }, { "CANCEL", 223, true }, { "CAPSLOCK", 58, true }, { "CD", 383, true },
+    { "CHANNEL", 363, true }, { "CHANNELDOWN", 403, true }, { "CHANNELUP", 402, true }, { "CHAT", 216, true },
+    { "CLEAR", 355, true }, { "CLEARVU_SONAR", 646, true }, { "CLOSE", 206, true }, { "CLOSECD", 160, true },
+    { "COFFEE", 152, true }, { "COMMA", 51, true }, { "COMPOSE", 127, true }, { "COMPUTER", 157, true },
+    { "CONFIG", 171, true }, { "CONNECT", 218, true }, { "CONTEXT_MENU", 438, true }, { "CONTROLPANEL", 579, true },
+    { "COPY", 133, true }, { "CUT", 137, true }, { "CYCLEWINDOWS", 154, true }, { "D", 32, true },
+    { "DASHBOARD", 204, false }, { "DATA", 631, true }, { "DATABASE", 426, true }, { "DELETE", 111, true },
+    { "DELETEFILE", 146, true }, { "DEL_EOL", 448, true }, { "DEL_EOS", 449, true }, { "DEL_LINE", 451, true },
+    { "DICTATE", 586, true }, { "DIGITS", 413, true }, { "DIRECTION", 153, false }, { "DIRECTORY", 394, true },
+    { "DISPLAYTOGGLE", 431, true }, { "DISPLAY_OFF", 245, true }, { "DOCUMENTS", 235, true }, { "DOLLAR", 434, true },
+    { "DOT", 52, true }, { "DOWN", 108, true }, { "DUAL_RANGE_RADAR", 643, true }, { "DVD", 389, true },
+    { "E", 18, true }, { "EDIT", 176, true }, { "EDITOR", 422, true }, { "EJECTCD", 161, true },
+    { "EJECTCLOSECD", 162, true }, { "EMAIL", 215, true }, { "EMOJI_PICKER", 585, true }, { "END", 107, true },
+    { "ENTER", 28, true }, { "EPG", 365, true }, { "EQUAL", 13, true }, { "ESC", 1, true }, { "EURO", 435, true },
+    { "EXIT", 174, true }, { "F", 33, true }, { "F1", 59, true }, { "F10", 68, true }, { "F11", 87, true },
+    { "F12", 88, true }, { "F13", 183, true }, { "F14", 184, true }, { "F15", 185, true }, { "F16", 186, true },
+    { "F17", 187, true }, { "F18", 188, true }, { "F19", 189, true }, { "F2", 60, true }, { "F20", 190, true },
+    { "F21", 191, true }, { "F22", 192, true }, { "F23", 193, true }, { "F24", 194, true }, { "F3", 61, true },
+    { "F4", 62, true }, { "F5", 63, true }, { "F6", 64, true }, { "F7", 65, true }, { "F8", 66, true },
+    { "F9", 67, true }, { "FASTFORWARD", 208, true }, { "FASTREVERSE", 629, true }, { "FAVORITES", 364, true },
+    { "FILE", 144, true }, { "FINANCE", 219, true }, { "FIND", 136, true }, { "FIRST", 404, true },
+    { "FISHING_CHART", 641, true }, { "FN", 464, true }, { "FN_1", 478, true }, { "FN_2", 479, true },
+    { "FN_B", 484, true }, { "FN_D", 480, true }, { "FN_E", 481, true }, { "FN_ESC", 465, true },
+    { "FN_F", 482, true }, { "FN_F1", 466, true }, { "FN_F10", 475, true }, { "FN_F11", 476, true },
+    { "FN_F12", 477, true }, { "FN_F2", 467, true }, { "FN_F3", 468, true }, { "FN_F4", 469, true },
+    { "FN_F5", 470, true }, { "FN_F6", 471, true }, { "FN_F7", 472, true }, { "FN_F8", 473, true },
+    { "FN_F9", 474, true }, { "FN_RIGHT_SHIFT", 485, true }, { "FN_S", 483, true }, { "FORWARD", 159, true },
+    { "FORWARDMAIL", 233, true }, { "FRAMEBACK", 436, true }, { "FRAMEFORWARD", 437, true }, { "FRONT", 132, true },
+    { "FULL_SCREEN", 372, true }, { "G", 34, true }, { "GAMES", 417, true }, { "GOTO", 354, true },
+    { "GRAPHICSEDITOR", 424, true }, { "GRAVE", 41, true }, { "GREEN", 399, true }, { "H", 35, true },
+    { "HANGEUL", 122, true }, { "HANGUEL", 122, false }, { "HANGUP_PHONE", 446, true }, { "HANJA", 123, true },
+    { "HELP", 138, true }, { "HENKAN", 92, true }, { "HIRAGANA", 91, true }, { "HOME", 102, true },
+    { "HOMEPAGE", 172, true }, { "HP", 211, true }, { "I", 23, true }, { "IMAGES", 442, true }, { "INFO", 358, true },
+    { "INSERT", 110, true }, { "INS_LINE", 450, true }, { "ISO", 170, true }, { "J", 36, true },
+    { "JOURNAL", 578, true }, { "K", 37, true }, { "KATAKANA", 90, true }, { "KATAKANAHIRAGANA", 93, true },
+    { "KBDILLUMDOWN", 229, true }, { "KBDILLUMTOGGLE", 228, true }, { "KBDILLUMUP", 230, true },
+    { "KBDINPUTASSIST_ACCEPT", 612, true }, { "KBDINPUTASSIST_CANCEL", 613, true },
+    { "KBDINPUTASSIST_NEXT", 609, true }, { "KBDINPUTASSIST_NEXTGROUP", 611, true },
+    { "KBDINPUTASSIST_PREV", 608, true }, { "KBDINPUTASSIST_PREVGROUP", 610, true }, { "KBD_LAYOUT_NEXT", 584, true },
+    { "KBD_LCD_MENU1", 696, true }, { "KBD_LCD_MENU2", 697, true }, { "KBD_LCD_MENU3", 698, true },
+    { "KBD_LCD_MENU4", 699, true }, { "KBD_LCD_MENU5", 700, true }, { "KEYBOARD", 374, true }, { "KP0", 82, true },
+    { "KP1", 79, true }, { "KP2", 80, true }, { "KP3", 81, true }, { "KP4", 75, true }, { "KP5", 76, true },
+    { "KP6", 77, true }, { "KP7", 71, true }, { "KP8", 72, true }, { "KP9", 73, true }, { "KPASTERISK", 55, true },
+    { "KPCOMMA", 121, true }, { "KPDOT", 83, true }, { "KPENTER", 96, true }, { "KPEQUAL", 117, true },
+    { "KPJPCOMMA", 95, true }, { "KPLEFTPAREN", 179, true }, { "KPMINUS", 74, true }, { "KPPLUS", 78, true },
+    { "KPPLUSMINUS", 118, true }, { "KPRIGHTPAREN", 180, true }, { "KPSLASH", 98, true }, { "L", 38, true },
+    { "LANGUAGE", 368, true }, { "LAST", 405, true }, { "LEFT", 105, true }, { "LEFTALT", 56, true },
+    { "LEFTBRACE", 26, true }, { "LEFTCTRL", 29, true }, { "LEFTMETA", 125, true }, { "LEFTSHIFT", 42, true },
+    { "LEFT_DOWN", 617, true }, { "LEFT_UP", 616, true }, { "LIGHTS_TOGGLE", 542, true }, { "LINEFEED", 101, true },
+    { "LINK_PHONE", 447, true }, { "LIST", 395, true }, { "LOGOFF", 433, true }, { "M", 50, true },
+    { "MACRO", 112, true }, { "MACRO1", 656, true }, { "MACRO10", 665, true }, { "MACRO11", 666, true },
+    { "MACRO12", 667, true }, { "MACRO13", 668, true }, { "MACRO14", 669, true }, { "MACRO15", 670, true },
+    { "MACRO16", 671, true }, { "MACRO17", 672, true }, { "MACRO18", 673, true }, { "MACRO19", 674, true },
+    { "MACRO2", 657, true }, { "MACRO20", 675, true }, { "MACRO21", 676, true }, { "MACRO22", 677, true },
+    { "MACRO23", 678, true }, { "MACRO24", 679, true }, { "MACRO25", 680, true }, { "MACRO26", 681, true },
+    { "MACRO27", 682, true }, { "MACRO28", 683, true }, { "MACRO29", 684, true }, { "MACRO3", 658, true },
+    { "MACRO30", 685, true }, { "MACRO4", 659, true }, { "MACRO5", 660, true }, { "MACRO6", 661, true },
+    { "MACRO7", 662, true }, { "MACRO8", 663, true }, { "MACRO9", 664, true }, { "MACRO_PRESET1", 691, true },
+    { "MACRO_PRESET2", 692, true }, { "MACRO_PRESET3", 693, true }, { "MACRO_PRESET_CYCLE", 690, true },
+    { "MACRO_RECORD_START", 688, true }, { "MACRO_RECORD_STOP", 689, true }, { "MAIL", 155, true },
+    { "MARK_WAYPOINT", 638, true }, { "MEDIA", 226, true }, { "MEDIA_REPEAT", 439, true },
+    { "MEDIA_TOP_MENU", 619, true }, { "MEMO", 396, true }, { "MENU", 139, true }, { "MESSENGER", 430, true },
+    { "MHP", 367, true }, { "MICMUTE", 248, true }, { "MINUS", 12, true }, { "MODE", 373, true },
+    { "MOVE", 175, true }, { "MP3", 391, true }, { "MSDOS", 151, true }, { "MUHENKAN", 94, true },
+    { "MUTE", 113, true }, { "N", 49, true }, { "NAV_CHART", 640, true }, { "NAV_INFO", 648, true },
+    { "NEW", 181, true }, { "NEWS", 427, true }, { "NEXT", 407, true }, { "NEXTSONG", 163, true },
+    { "NEXT_ELEMENT", 635, true }, { "NEXT_FAVORITE", 624, true }, { "NOTIFICATION_CENTER", 444, true },
+    { "NUMERIC_0", 512, true }, { "NUMERIC_1", 513, true }, { "NUMERIC_11", 620, true }, { "NUMERIC_12", 621, true },
+    { "NUMERIC_2", 514, true }, { "NUMERIC_3", 515, true }, { "NUMERIC_4", 516, true }, { "NUMERIC_5", 517, true },
+    { "NUMERIC_6", 518, true }, { "NUMERIC_7", 519, true }, { "NUMERIC_8", 520, true }, { "NUMERIC_9", 521, true },
+    { "NUMERIC_A", 524, true }, { "NUMERIC_B", 525, true }, { "NUMERIC_C", 526, true }, { "NUMERIC_D", 527, true },
+    { "NUMERIC_POUND", 523, true }, { "NUMERIC_STAR", 522, true }, { "NUMLOCK", 69, true }, { "O", 24, true },
+    { "OK", 352, true }, { "ONSCREEN_KEYBOARD", 632, true }, { "OPEN", 134, true }, { "OPTION", 357, true },
+    { "P", 25, true }, { "PAGEDOWN", 109, true }, { "PAGEUP", 104, true }, { "PASTE", 135, true },
+    { "PAUSE", 119, true }, { "PAUSECD", 201, true }, { "PAUSE_RECORD", 626, true }, { "PC", 376, true },
+    { "PHONE", 169, true }, { "PICKUP_PHONE", 445, true }, { "PLAY", 207, true }, { "PLAYCD", 200, true },
+    { "PLAYER", 387, true }, { "PLAYPAUSE", 164, true }, { "POWER", 116, true }, { "POWER2", 356, true },
+    { "PRESENTATION", 425, true }, { "PREVIOUS", 412, true }, { "PREVIOUSSONG", 165, true },
+    { "PREVIOUS_ELEMENT", 636, true }, { "PRINT", 210, true }, { "PRIVACY_SCREEN_TOGGLE", 633, true },
+    { "PROG1", 148, true }, { "PROG2", 149, true }, { "PROG3", 202, true }, { "PROG4", 203, true },
+    { "PROGRAM", 362, true }, { "PROPS", 130, true }, { "PVR", 366, true }, { "Q", 16, true },
+    { "QUESTION", 214, true }, { "R", 19, true }, { "RADAR_OVERLAY", 644, true }, { "RADIO", 385, true },
+    { "RECORD", 167, true }, { "RED", 398, true }, { "REDO", 182, true }, { "REFRESH", 173, true },
+    { "REFRESH_RATE_TOGGLE", 562, true }, { "REPLY", 232, true }, { "RESTART", 408, true }, { "REWIND", 168, true },
+    { "RFKILL", 247, true }, { "RIGHT", 106, true }, { "RIGHTALT", 100, true }, { "RIGHTBRACE", 27, true },
+    { "RIGHTCTRL", 97, true }, { "RIGHTMETA", 126, true }, { "RIGHTSHIFT", 54, true }, { "RIGHT_DOWN", 615, true },
+    { "RIGHT_UP", 614, true }, { "RO", 89, true }, { "ROOT_MENU", 618, true }, { "ROTATE_DISPLAY", 153, true },
+    { "ROTATE_LOCK_TOGGLE", 561, true }, { "S", 31, true }, { "SAT", 381, true }, { "SAT2", 382, true },
+    { "SAVE", 234, true }, { "SCALE", 120, true }, { "SCREEN", 375, false }, { "SCREENLOCK", 152, false },
+    { "SCREENSAVER", 581, true }, { "SCROLLDOWN", 178, true }, { "SCROLLLOCK", 70, true }, { "SCROLLUP", 177, true },
+    { "SEARCH", 217, true }, { "SELECT", 353, true }, { "SELECTIVE_SCREENSHOT", 634, true },
+    { "SEMICOLON", 39, true }, { "SEND", 231, true }, { "SENDFILE", 145, true }, { "SETUP", 141, true },
+    { "SHOP", 221, true }, { "SHUFFLE", 410, true }, { "SIDEVU_SONAR", 647, true },
+    { "SINGLE_RANGE_RADAR", 642, true }, { "SLASH", 53, true }, { "SLEEP", 142, true }, { "SLOW", 409, true },
+    { "SLOWREVERSE", 630, true }, { "SOS", 639, true }, { "SOUND", 213, true }, { "SPACE", 57, true },
+    { "SPELLCHECK", 432, true }, { "SPORT", 220, true }, { "SPREADSHEET", 423, true }, { "STOP", 128, true },
+    { "STOPCD", 166, true }, { "STOP_RECORD", 625, true }, { "SUBTITLE", 370, true }, { "SUSPEND", 205, true },
+    { "SWITCHVIDEOMODE", 227, true }, { "SYSRQ", 99, true }, { "T", 20, true }, { "TAB", 15, true },
+    { "TAPE", 384, true }, { "TASKMANAGER", 577, true }, { "TEEN", 414, true }, { "TEXT", 388, true },
+    { "TIME", 359, true }, { "TITLE", 369, true }, { "TOUCHPAD_OFF", 532, true }, { "TOUCHPAD_ON", 531, true },
+    { "TOUCHPAD_TOGGLE", 530, true }, { "TRADITIONAL_SONAR", 645, true }, { "TUNER", 386, true }, { "TV", 377, true },
+    { "TV2", 378, true }, { "TWEN", 415, true }, { "U", 22, true }, { "UNDO", 131, true }, { "UNKNOWN", 240, true },
+    { "UNMUTE", 628, true }, { "UP", 103, true }, { "UWB", 239, true }, { "V", 47, true }, { "VCR", 379, true },
+    { "VCR2", 380, true }, { "VENDOR", 360, true }, { "VIDEO", 393, true }, { "VIDEOPHONE", 416, true },
+    { "VIDEO_NEXT", 241, true }, { "VIDEO_PREV", 242, true }, { "VOD", 627, true }, { "VOICECOMMAND", 582, true },
+    { "VOICEMAIL", 428, true }, { "VOLUMEDOWN", 114, true }, { "VOLUMEUP", 115, true }, { "W", 17, true },
+    { "WAKEUP", 143, true }, { "WIMAX", 246, false }, { "WLAN", 238, true }, { "WORDPROCESSOR", 421, true },
+    { "WPS_BUTTON", 529, true }, { "WWAN", 246, true }, { "WWW", 150, true }, { "X", 45, true },
+    { "XFER", 147, true }, { "Y", 21, true }, { "YELLOW", 400, true }, { "YEN", 124, true }, { "Z", 44, true },
+    { "ZENKAKUHANKAKU", 85, true }, { "ZOOM", 372, false }, { "ZOOMIN", 418, true }, { "ZOOMOUT", 419, true },
+    { "ZOOMRESET", 420, true },
+};
+
+inline constexpr size_t KEY_NAME_COUNT = sizeof(g_key_names) / sizeof(g_key_names[0]);
+inline constexpr uint16_t KEY_NAME_NONE = 0xFFFF;
+
+constexpr bool key_names_sorted() {
+    for (size_t i = 1; i < KEY_NAME_COUNT; i++) {
+        if (!(g_key_names[i - 1].name < g_key_names[i].name)) return false;
+    }
+    for (size_t i = 0; i < KEY_NAME_COUNT; i++) {
+        if (g_key_names[i].code >= KEY_CNT) return false;
+    }
+    return true;
+}
+static_assert(key_names_sorted(), "g_key_names must be sorted by name with codes below KEY_CNT");
+
+// 按键码 -> g_key_names下标
+struct KeyCodeIndex {
+    uint16_t index[KEY_CNT];
+};
+
+constexpr KeyCodeIndex build_key_code_index() {
+    KeyCodeIndex table{};
+    for (size_t code = 0; code < KEY_CNT; code++) table.index[code] = KEY_NAME_NONE;
+    for (size_t i = 0; i < KEY_NAME_COUNT; i++) {
+        if (g_key_names[i].primary) table.index[g_key_names[i].code] = static_cast<uint16_t>(i);
+    }
+    return table;
+}
+
+inline constexpr KeyCodeIndex g_key_code_index = build_key_code_index();
+
+// 按键码 -> 名称（以'\0'结尾），未知时返回nullptr
+constexpr const char* key_name(int code) {
+    if (code < 0 || code >= KEY_CNT) return nullptr;
+    uint16_t index = g_key_code_index.index[code];
+    return index == KEY_NAME_NONE ? nullptr : g_key_names[index].name.data();
+}
+
+// 名称 -> 按键码，不区分大小写，可带KEY_前缀；未知时返回-1
+constexpr int key_code(std::string_view name) {
+    if (name.size() > 4 && (name[0] | 0x20) == 'k' && (name[1] | 0x20) == 'e' && (name[2] | 0x20) == 'y' &&
+        name[3] == '_') {
+        name.remove_prefix(4);
+    }
+    char upper[32] = {};
+    if (name.empty() || name.size() > sizeof(upper)) return -1;
+    for (size_t i = 0; i < name.size(); i++) {
+        char c = name[i];
+        upper[i] = (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+    }
+    std::string_view key(upper, name.size());
+    size_t lo = 0, hi = KEY_NAME_COUNT;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (g_key_names[mid].name < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < KEY_NAME_COUNT && g_key_names[lo].name == key) ? g_key_names[lo].code : -1;
+}
+
+static_assert(key_code("VOLUMEUP") == KEY_VOLUMEUP && key_code("key_power") == KEY_POWER, "key_code lookup");
+static_assert(key_code("BTN_A") == BTN_A && key_name(BTN_A) != nullptr, "key_code lookup");
+
+#endif // KCTRL_KEYCODES_H
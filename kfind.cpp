@@ -9,16 +9,17 @@
 #include <linux/input.h>
 #include <android/log.h>
 #include <map>
+#include <algorithm>
+#include <cmath>
 #include <string>
 #include <sstream>
 #include <vector>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
 #include <atomic>
-#include <chrono>
 #include <dirent.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include "keycodes.h"
 
 #define LOG_TAG "KFIND"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
@@ -29,19 +30,13 @@
 static std::atomic<bool> g_running{true};
 static std::map<std::string, std::string> g_config;
 static std::string g_config_dir;
-static std::mutex g_output_mutex;
-static std::condition_variable g_shutdown_cv;
 
 // 信号处理函数
 void signal_handler(int sig) {
     if (sig == SIGTERM || sig == SIGINT) {
         g_running = false;
         LOGI("Received signal %d, shutting down...", sig);
-        {
-            std::lock_guard<std::mutex> lock(g_output_mutex);
-            std::cout << "\nShutting down..." << std::endl;
-        }
-        g_shutdown_cv.notify_all();
+        std::cout << "\nShutting down..." << std::endl;
     }
 }
 
@@ -82,150 +77,175 @@ bool load_config(const std::string& config_file) {
     return true;
 }
 
-// 获取按键名称
-std::string get_key_name(int keycode) {
-    static std::map<int, std::string> key_names = {
-        {KEY_POWER, "POWER"},
-        {KEY_VOLUMEUP, "VOLUME_UP"},
-        {KEY_VOLUMEDOWN, "VOLUME_DOWN"},
-        {KEY_HOME, "HOME"},
-        {KEY_BACK, "BACK"},
-        {KEY_MENU, "MENU"},
-        {KEY_SEARCH, "SEARCH"},
-        {KEY_CAMERA, "CAMERA"},
-        // {KEY_FOCUS, "FOCUS"}, // Not available in this Android API level
-        {KEY_ESC, "ESC"},
-        {KEY_1, "1"}, {KEY_2, "2"}, {KEY_3, "3"}, {KEY_4, "4"}, {KEY_5, "5"},
-        {KEY_6, "6"}, {KEY_7, "7"}, {KEY_8, "8"}, {KEY_9, "9"}, {KEY_0, "0"},
-        {KEY_A, "A"}, {KEY_B, "B"}, {KEY_C, "C"}, {KEY_D, "D"}, {KEY_E, "E"},
-        {KEY_F, "F"}, {KEY_G, "G"}, {KEY_H, "H"}, {KEY_I, "I"}, {KEY_J, "J"},
-        {KEY_K, "K"}, {KEY_L, "L"}, {KEY_M, "M"}, {KEY_N, "N"}, {KEY_O, "O"},
-        {KEY_P, "P"}, {KEY_Q, "Q"}, {KEY_R, "R"}, {KEY_S, "S"}, {KEY_T, "T"},
-        {KEY_U, "U"}, {KEY_V, "V"}, {KEY_W, "W"}, {KEY_X, "X"}, {KEY_Y, "Y"},
-        {KEY_Z, "Z"},
-        {KEY_ENTER, "ENTER"},
-        {KEY_SPACE, "SPACE"},
-        {KEY_TAB, "TAB"},
-        {KEY_LEFTSHIFT, "LEFT_SHIFT"},
-        {KEY_RIGHTSHIFT, "RIGHT_SHIFT"},
-        {KEY_LEFTCTRL, "LEFT_CTRL"},
-        {KEY_RIGHTCTRL, "RIGHT_CTRL"},
-        {KEY_LEFTALT, "LEFT_ALT"},
-        {KEY_RIGHTALT, "RIGHT_ALT"},
-        {KEY_UP, "UP"},
-        {KEY_DOWN, "DOWN"},
-        {KEY_LEFT, "LEFT"},
-        {KEY_RIGHT, "RIGHT"}
-    };
-    
-    auto it = key_names.find(keycode);
-    if (it != key_names.end()) {
-        return it->second;
-    }
-    return "UNKNOWN";
+// 配置中的整数值，缺失或无效时返回默认值
+static int config_int(const std::string& key, int default_value) {
+    auto it = g_config.find(key);
+    if (it == g_config.end() || it->second.empty()) return default_value;
+    const char* start = it->second.c_str();
+    char* end = nullptr;
+    long value = strtol(start, &end, 10);  // 忽略数值后的行内注释
+    return (end != start && value >= 0) ? static_cast<int>(value) : default_value;
+}
+
+// 获取按键名称（与配置中可用的符号名称一致）
+static const char* get_key_name(int keycode) {
+    const char* name = key_name(keycode);
+    return name ? name : "UNKNOWN";
+}
+
+// 被监听的输入设备
+struct WatchedDevice {
+    std::string path;
+    int fd;
+    clockid_t clock;  // 事件时间戳所用的时钟，切换失败时为内核默认的CLOCK_REALTIME
+};
+
+// 按键事件值对应的类型名
+static const char* event_value_name(int value) {
+    switch (value) {
+        case 0: return "RELEASE";
+        case 1: return "PRESS";
+        case 2: return "REPEAT";
+        default: return "UNKNOWN";
+    }
 }
 
-// 监听单个输入设备
-void monitor_input_device(const std::string& device_path) {
-    int fd = open(device_path.c_str(), O_RDONLY | O_NONBLOCK);
+// 打开输入设备，事件时间戳切换为CLOCK_MONOTONIC；clock返回设备实际使用的事件时钟
+static int open_input_device(const std::string& device_path, clockid_t& clock) {
+    int fd = open(device_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
     if (fd == -1) {
         LOGE("Failed to open device: %s - %s", device_path.c_str(), strerror(errno));
         std::cerr << "Error: Cannot open device " << device_path << ": " << strerror(errno) << std::endl;
         std::cerr << "Make sure you have root permissions and the device path is correct." << std::endl;
-        return;
+        return -1;
+    }
+    
+    int clock_id = CLOCK_MONOTONIC;
+    if (ioctl(fd, EVIOCSCLOCKID, &clock_id) == 0) {
+        clock = CLOCK_MONOTONIC;
+    } else {
+        clock = CLOCK_REALTIME;
+        LOGW("Cannot switch event clock of %s: %s", device_path.c_str(), strerror(errno));
+        std::cerr << "Warning: " << device_path << " keeps CLOCK_REALTIME event times (EVIOCSCLOCKID: "
+                  << strerror(errno) << ")" << std::endl;
     }
     
     LOGI("Monitoring device: %s", device_path.c_str());
-    {
-        std::lock_guard<std::mutex> lock(g_output_mutex);
-        std::cout << "Monitoring device: " << device_path << std::endl;
+    std::cout << "Monitoring device: " << device_path << std::endl;
+    return fd;
+}
+
+// 以换行分隔的记录格式写出一个按键事件：<内核时间戳> <按键码> <名称> <值> <设备>
+static void write_event_record(FILE* out, const struct input_event& event, const std::string& device_path) {
+    fprintf(out, "%lld.%06ld %d %s %d %s\n",
+            (long long)event.input_event_sec, (long)event.input_event_usec,
+            event.code, get_key_name(event.code), event.value, device_path.c_str());
+}
+
+// 单个epoll循环监听所有设备
+// 默认模式：检测到第一次按键释放后退出，并把最后一个事件写入kfind.txt
+// 连续模式：持续将事件记录写入同一个带缓冲的输出流，每次循环唤醒只刷新一次
+static int run_capture(std::vector<WatchedDevice>& devices, bool continuous, FILE* stream_out) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        LOGE("epoll_create1 failed: %s", strerror(errno));
+        return 1;
+    }
+    for (size_t i = 0; i < devices.size(); i++) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = static_cast<uint32_t>(i);
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, devices[i].fd, &ev);
     }
     
-    struct input_event event;
+    struct input_event last_event;
+    memset(&last_event, 0, sizeof(last_event));
+    size_t last_device = 0;
+    bool has_last_event = false;
+    size_t open_devices = devices.size();
     
-    while (g_running) {
-        ssize_t bytes = read(fd, &event, sizeof(event));
-        if (bytes != sizeof(event)) {
-            if (bytes == -1) {
-                if (errno == EINTR) {
-                    if (!g_running) break; // 检查是否需要退出
-                    continue; // 被信号中断，继续读取
-                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    // 非阻塞模式下没有数据可读，短暂休眠后继续
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    continue;
-                } else {
-                    LOGE("Failed to read event: %s", strerror(errno));
-                    break;
-                }
-            } else {
-                // 读取的字节数不正确
-                continue;
-            }
-        }
-        
-        // 再次检查g_running状态
-        if (!g_running) {
+    struct epoll_event ready[16];
+    struct input_event events[64];
+    while (g_running && open_devices > 0) {
+        int n = epoll_wait(epoll_fd, ready, sizeof(ready) / sizeof(ready[0]), -1);
+        if (n == -1) {
+            if (errno == EINTR) continue; // 被信号中断，回到循环检查g_running
+            LOGE("epoll_wait failed: %s", strerror(errno));
             break;
         }
         
-        // 只处理按键事件
-            if (event.type == EV_KEY) {
-                std::string key_name = get_key_name(event.code);
-                std::string event_type;
+        for (int i = 0; i < n && g_running; i++) {
+            WatchedDevice& dev = devices[ready[i].data.u32];
+            ssize_t bytes = read(dev.fd, events, sizeof(events));
+            if (bytes == -1) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                LOGE("Failed to read event from %s: %s", dev.path.c_str(), strerror(errno));
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, dev.fd, nullptr);
+                close(dev.fd);
+                dev.fd = -1;
+                open_devices--;
+                continue;
+            }
+            
+            size_t count = bytes / sizeof(struct input_event);
+            for (size_t j = 0; j < count; j++) {
+                const struct input_event& event = events[j];
+                // 只处理按键事件
+                if (event.type != EV_KEY) continue;
                 
-                switch (event.value) {
-                    case 0:
-                        event_type = "RELEASE";
-                        break;
-                    case 1:
-                        event_type = "PRESS";
-                        break;
-                    case 2:
-                        event_type = "REPEAT";
-                        break;
-                    default:
-                        event_type = "UNKNOWN";
-                        break;
+                if (continuous) {
+                    write_event_record(stream_out, event, dev.path);
+                    continue;
                 }
                 
-                // 线程安全的输出和文件写入
-                {
-                    std::lock_guard<std::mutex> lock(g_output_mutex);
-                    
-                    // 输出按键信息
-                    std::cout << "[" << event.code << "] " << key_name 
-                              << " - " << event_type << " (" << event.value << ") [" << device_path << "]" << std::endl;
-                    
-                    // 记录到日志
-                    LOGI("Key event: code=%d, name=%s, type=%s, value=%d, device=%s", 
-                         event.code, key_name.c_str(), event_type.c_str(), event.value, device_path.c_str());
-                    
-                    // 写入到kfind.txt文件
-                    std::string output_path = g_config_dir + "kfind.txt";
-                    FILE* output_file = fopen(output_path.c_str(), "w");
-                    if (output_file) {
-                        fprintf(output_file, "[%d] %s - %s (%d) [%s]\n", 
-                                event.code, key_name.c_str(), event_type.c_str(), event.value, device_path.c_str());
-                        fclose(output_file);
-                    }
-                    
-                    // 如果是按键释放事件，表示一次完整的按下抬起操作结束，退出程序
-                    if (event.value == 0) {
-                        std::cout << "检测到完整按键操作，程序即将退出..." << std::endl;
-                        LOGI("Complete key press-release detected, shutting down...");
-                        g_running = false;
-                        g_shutdown_cv.notify_all();
-                        close(fd);
-                        LOGI("Stopped monitoring device: %s", device_path.c_str());
-                        return;
-                    }
+                // 输出按键信息
+                std::cout << "[" << event.code << "] " << get_key_name(event.code)
+                          << " - " << event_value_name(event.value) << " (" << event.value << ") [" << dev.path << "]" << std::endl;
+                
+                // 记录到日志
+                LOGI("Key event: code=%d, name=%s, type=%s, value=%d, device=%s",
+                     event.code, get_key_name(event.code), event_value_name(event.value), event.value, dev.path.c_str());
+                
+                last_event = event;
+                last_device = ready[i].data.u32;
+                has_last_event = true;
+                
+                // 如果是按键释放事件，表示一次完整的按下抬起操作结束，退出程序
+                if (event.value == 0) {
+                    std::cout << "检测到完整按键操作，程序即将退出..." << std::endl;
+                    LOGI("Complete key press-release detected, shutting down...");
+                    g_running = false;
+                    break;
                 }
             }
+        }
+        
+        // 连续模式下每次唤醒只产生一次写入
+        if (continuous) fflush(stream_out);
     }
     
-    close(fd);
-    LOGI("Stopped monitoring device: %s", device_path.c_str());
+    // 默认模式：只在结束时写一次kfind.txt，内容与原先逐事件覆盖写入的最终结果一致
+    if (!continuous && has_last_event) {
+        std::string output_path = g_config_dir + "kfind.txt";
+        FILE* output_file = fopen(output_path.c_str(), "w");
+        if (output_file) {
+            fprintf(output_file, "[%d] %s - %s (%d) [%s]\n",
+                    last_event.code, get_key_name(last_event.code), event_value_name(last_event.value),
+                    last_event.value, devices[last_device].path.c_str());
+            fclose(output_file);
+        }
+    }
+    
+    for (auto& dev : devices) {
+        if (dev.fd != -1) {
+            close(dev.fd);
+            dev.fd = -1;
+            LOGI("Stopped monitoring device: %s", dev.path.c_str());
+        }
+    }
+    close(epoll_fd);
+    return 0;
 }
 
 // 基于通配符的简单匹配（仅支持'*'）
@@ -315,6 +335,559 @@ static std::vector<std::string> resolve_device_config_kf(const std::string& devi
     return resolved;
 }
 
+// 设备分析模式：每个设备的事件速率、SYN帧突发大小与投递延迟直方图
+#define PROFILE_BUCKETS 20  // 按2的幂划分：[0,1) [1,2) [2,4) ... 微秒/事件数
+
+struct DeviceProfile {
+    std::string name;
+    uint64_t events_by_type[EV_CNT];
+    uint64_t total_events;
+    uint64_t frames;
+    uint32_t frame_events;               // 当前SYN帧中已累计的事件数
+    uint64_t burst_hist[PROFILE_BUCKETS]; // 每个SYN帧包含的事件数
+    uint64_t lag_hist[PROFILE_BUCKETS];   // 读取时间 - 事件时间（微秒）
+    uint64_t lag_min_us;
+    uint64_t lag_max_us;
+    uint64_t lag_total_us;
+};
+
+// 计算值所在的2的幂桶
+static int log2_bucket(uint64_t value) {
+    int bucket = 0;
+    while (value > 0 && bucket < PROFILE_BUCKETS - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// 由直方图估算百分位（返回所在桶的上界）
+static uint64_t hist_percentile(const uint64_t* hist, uint64_t total, double pct) {
+    if (total == 0) return 0;
+    uint64_t target = static_cast<uint64_t>(total * pct);
+    uint64_t seen = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > target) return b == 0 ? 0 : (1ULL << b) - 1;
+    }
+    return (1ULL << (PROFILE_BUCKETS - 1));
+}
+
+// 事件类型名称
+static const char* event_type_name(int type) {
+    switch (type) {
+        case EV_SYN: return "SYN";
+        case EV_KEY: return "KEY";
+        case EV_REL: return "REL";
+        case EV_ABS: return "ABS";
+        case EV_MSC: return "MSC";
+        case EV_SW:  return "SW";
+        case EV_LED: return "LED";
+        default:     return nullptr;
+    }
+}
+
+// 输出一个直方图
+static void print_hist(FILE* out, const char* title, const uint64_t* hist, const char* unit) {
+    fprintf(out, "  %s:\n", title);
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        if (hist[b] == 0) continue;
+        uint64_t low = b == 0 ? 0 : (1ULL << (b - 1));
+        uint64_t high = (1ULL << b);
+        fprintf(out, "    [%llu, %llu) %s: %llu\n", (unsigned long long)low, (unsigned long long)high,
+                unit, (unsigned long long)hist[b]);
+    }
+}
+
+// 输出分析报告
+static void print_profile_report(FILE* out, const std::vector<WatchedDevice>& devices,
+                                 const std::vector<DeviceProfile>& profiles, double seconds) {
+    fprintf(out, "KFIND device profile (%.1fs)\n", seconds);
+    for (size_t i = 0; i < devices.size(); i++) {
+        const DeviceProfile& p = profiles[i];
+        fprintf(out, "%s \"%s\"\n", devices[i].path.c_str(), p.name.c_str());
+        fprintf(out, "  events: %llu (%.1f/s), frames: %llu (%.1f/s)\n",
+                (unsigned long long)p.total_events, p.total_events / seconds,
+                (unsigned long long)p.frames, p.frames / seconds);
+        if (p.total_events == 0) continue;
+        
+        fprintf(out, "  by type:");
+        uint64_t other = 0;
+        for (int t = 0; t < EV_CNT; t++) {
+            if (p.events_by_type[t] == 0) continue;
+            const char* name = event_type_name(t);
+            if (name) {
+                fprintf(out, " %s=%.1f/s", name, p.events_by_type[t] / seconds);
+            } else {
+                other += p.events_by_type[t];
+            }
+        }
+        if (other) fprintf(out, " OTHER=%.1f/s", other / seconds);
+        fprintf(out, "\n");
+        
+        if (devices[i].clock != CLOCK_MONOTONIC) fprintf(out, "  lag measured against CLOCK_REALTIME (clock switch failed)\n");
+        fprintf(out, "  lag us: min=%llu avg=%llu p50<=%llu p99<=%llu max=%llu\n",
+                (unsigned long long)p.lag_min_us, (unsigned long long)(p.lag_total_us / p.total_events),
+                (unsigned long long)hist_percentile(p.lag_hist, p.total_events, 0.50),
+                (unsigned long long)hist_percentile(p.lag_hist, p.total_events, 0.99),
+                (unsigned long long)p.lag_max_us);
+        print_hist(out, "burst size per SYN frame", p.burst_hist, "events");
+        print_hist(out, "delivery lag (read - ev.time)", p.lag_hist, "us");
+    }
+}
+
+// 在指定时长内监听设备并统计，结果输出到标准输出与kprofile.txt
+static int run_profile(std::vector<WatchedDevice>& devices, int duration_sec) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        LOGE("epoll_create1 failed: %s", strerror(errno));
+        return 1;
+    }
+    
+    std::vector<DeviceProfile> profiles(devices.size());
+    for (size_t i = 0; i < devices.size(); i++) {
+        DeviceProfile& p = profiles[i];
+        memset(p.events_by_type, 0, sizeof(p.events_by_type));
+        memset(p.burst_hist, 0, sizeof(p.burst_hist));
+        memset(p.lag_hist, 0, sizeof(p.lag_hist));
+        p.total_events = p.frames = p.lag_total_us = p.lag_max_us = 0;
+        p.frame_events = 0;
+        p.lag_min_us = UINT64_MAX;
+        if (!get_input_device_name_kf(devices[i].path, p.name)) p.name = "<unknown>";
+        
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = static_cast<uint32_t>(i);
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, devices[i].fd, &ev);
+    }
+    
+    std::cout << "Profiling " << devices.size() << " device(s) for " << duration_sec << "s (Ctrl+C to stop early)..." << std::endl;
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t start_ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    int64_t deadline_ms = start_ms + duration_sec * 1000LL;
+    
+    struct epoll_event ready[16];
+    struct input_event events[64];
+    int64_t now_ms = start_ms;
+    while (g_running && now_ms < deadline_ms) {
+        int n = epoll_wait(epoll_fd, ready, sizeof(ready) / sizeof(ready[0]), static_cast<int>(deadline_ms - now_ms));
+        if (n == -1 && errno != EINTR) {
+            LOGE("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        
+        for (int i = 0; i < n; i++) {
+            WatchedDevice& dev = devices[ready[i].data.u32];
+            DeviceProfile& p = profiles[ready[i].data.u32];
+            ssize_t bytes = read(dev.fd, events, sizeof(events));
+            // 读取完成的时刻，取与该设备事件时间相同的时钟
+            clock_gettime(dev.clock, &ts);
+            if (bytes <= 0) {
+                if (bytes == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, dev.fd, nullptr);
+                continue;
+            }
+            uint64_t read_us = static_cast<uint64_t>(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
+            
+            size_t count = bytes / sizeof(struct input_event);
+            for (size_t j = 0; j < count; j++) {
+                const struct input_event& event = events[j];
+                uint64_t event_us = static_cast<uint64_t>(event.input_event_sec) * 1000000ULL + event.input_event_usec;
+                uint64_t lag_us = read_us > event_us ? read_us - event_us : 0;
+                
+                if (event.type < EV_CNT) p.events_by_type[event.type]++;
+                p.total_events++;
+                p.lag_hist[log2_bucket(lag_us)]++;
+                p.lag_total_us += lag_us;
+                if (lag_us < p.lag_min_us) p.lag_min_us = lag_us;
+                if (lag_us > p.lag_max_us) p.lag_max_us = lag_us;
+                
+                if (event.type == EV_SYN && event.code == SYN_REPORT) {
+                    p.burst_hist[log2_bucket(p.frame_events)]++;
+                    p.frames++;
+                    p.frame_events = 0;
+                } else {
+                    p.frame_events++;
+                }
+            }
+        }
+        
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now_ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    }
+    close(epoll_fd);
+    
+    double seconds = (now_ms - start_ms) / 1000.0;
+    if (seconds <= 0) seconds = 0.001;
+    for (auto& p : profiles) {
+        if (p.total_events == 0) p.lag_min_us = 0;
+    }
+    
+    print_profile_report(stdout, devices, profiles, seconds);
+    std::string report_path = g_config_dir + "kprofile.txt";
+    FILE* report_file = fopen(report_path.c_str(), "w");
+    if (report_file) {
+        print_profile_report(report_file, devices, profiles, seconds);
+        fclose(report_file);
+        std::cout << "Report written to " << report_path << std::endl;
+    }
+    
+    for (auto& dev : devices) {
+        close(dev.fd);
+        dev.fd = -1;
+    }
+    return 0;
+}
+
+// 学习模式：记录用户自己的按压时长与连击间隔，拟合最紧的手势阈值
+struct PressSample {
+    uint64_t press_us;
+    uint64_t release_us;
+};
+
+// 一维k-means（对数域），返回每个簇排好序的样本；样本不足时簇数相应减少
+static std::vector<std::vector<double>> cluster_log_kmeans(std::vector<double> values, int k) {
+    std::sort(values.begin(), values.end());
+    std::vector<std::vector<double>> clusters;
+    if (values.empty()) return clusters;
+    if (static_cast<int>(values.size()) < k * 3) k = std::max(1, static_cast<int>(values.size()) / 3);
+    
+    // 按分位数初始化中心
+    std::vector<double> centers(k);
+    for (int c = 0; c < k; c++) {
+        size_t idx = (values.size() - 1) * (2 * c + 1) / (2 * k);
+        centers[c] = std::log(std::max(values[idx], 1.0));
+    }
+    
+    // 样本已排序，每个簇是一段连续区间，用边界下标表示
+    std::vector<size_t> bounds(k + 1, 0);
+    for (int iter = 0; iter < 50; iter++) {
+        std::vector<size_t> new_bounds(k + 1, 0);
+        new_bounds[k] = values.size();
+        int c = 0;
+        for (size_t i = 0; i < values.size(); i++) {
+            double v = std::log(std::max(values[i], 1.0));
+            while (c + 1 < k && std::fabs(v - centers[c + 1]) < std::fabs(v - centers[c])) {
+                new_bounds[++c] = i;
+            }
+        }
+        while (c + 1 < k) new_bounds[++c] = values.size();
+        
+        bool changed = (new_bounds != bounds);
+        bounds = new_bounds;
+        for (int j = 0; j < k; j++) {
+            if (bounds[j + 1] <= bounds[j]) continue;
+            double sum = 0;
+            for (size_t i = bounds[j]; i < bounds[j + 1]; i++) sum += std::log(std::max(values[i], 1.0));
+            centers[j] = sum / (bounds[j + 1] - bounds[j]);
+        }
+        if (!changed) break;
+    }
+    
+    for (int j = 0; j < k; j++) {
+        if (bounds[j + 1] > bounds[j]) {
+            clusters.emplace_back(values.begin() + bounds[j], values.begin() + bounds[j + 1]);
+        }
+    }
+    return clusters;
+}
+
+// 已排序样本的分位数
+static double sorted_quantile(const std::vector<double>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t idx = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+// 相邻两簇的中位数之比低于此值时视为同一类手势的自然波动，不在其间拟合阈值
+#define MIN_CLUSTER_RATIO 2.0
+// 超过此值的双击窗口会让每次单击都明显延迟，拟合结果超出时不采用
+#define MAX_DOUBLE_CLICK_INTERVAL 1000
+
+static bool clusters_separated(const std::vector<double>& lower, const std::vector<double>& upper) {
+    if (lower.empty() || upper.empty()) return false;
+    return sorted_quantile(upper, 0.5) >= sorted_quantile(lower, 0.5) * MIN_CLUSTER_RATIO;
+}
+
+// 合并未明显分开的相邻簇（簇内样本已排序，相邻簇拼接后仍有序）
+static void merge_close_clusters(std::vector<std::vector<double>>& clusters) {
+    for (size_t i = 1; i < clusters.size();) {
+        if (clusters_separated(clusters[i - 1], clusters[i])) {
+            i++;
+            continue;
+        }
+        clusters[i - 1].insert(clusters[i - 1].end(), clusters[i].begin(), clusters[i].end());
+        clusters.erase(clusters.begin() + i);
+    }
+}
+
+// 两个簇（均非空）之间的最紧阈值：取下簇的(1-target)分位数，若与上簇的target分位数冲突则取两者的几何平均
+static int fit_boundary(const std::vector<double>& lower, const std::vector<double>& upper, double target) {
+    double lower_edge = sorted_quantile(lower, 1.0 - target);
+    double upper_edge = sorted_quantile(upper, target);
+    double boundary = (lower_edge < upper_edge) ? lower_edge : std::sqrt(lower_edge * upper_edge);
+    return static_cast<int>(std::ceil(boundary / 10.0) * 10);
+}
+
+// 统计样本被阈值误判的比例（下簇超过阈值或上簇不超过阈值）
+static double misclassification_rate(const std::vector<double>& lower, const std::vector<double>& upper, int threshold) {
+    size_t wrong = 0;
+    for (double v : lower) if (v > threshold) wrong++;
+    for (double v : upper) if (v <= threshold) wrong++;
+    size_t total = lower.size() + upper.size();
+    return total ? static_cast<double>(wrong) / total : 0;
+}
+
+// 将阈值写回配置文件：替换已有行，缺失的追加到末尾；写临时文件后重命名，kctrl通过inotify自动重载
+static bool apply_thresholds(const std::string& config_file, const std::map<std::string, int>& values) {
+    std::ifstream in(config_file);
+    if (!in.is_open()) return false;
+    std::ostringstream out;
+    std::map<std::string, int> pending = values;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t eq = line.find('=');
+        if (eq != std::string::npos) {
+            // 与kctrl解析一致：键名去除首尾空白后比较，重复的键全部改写
+            std::string key = line.substr(0, eq);
+            key.erase(0, key.find_first_not_of(" \t\r"));
+            key.erase(key.find_last_not_of(" \t\r") + 1);
+            auto it = values.find(key);
+            if (it != values.end()) {
+                out << it->first << "=" << it->second << "\n";
+                pending.erase(it->first);
+                continue;
+            }
+        }
+        out << line << "\n";
+    }
+    in.close();
+    for (const auto& pair : pending) out << pair.first << "=" << pair.second << "\n";
+    
+    std::string tmp_path = config_file + ".tmp";
+    std::ofstream tmp(tmp_path);
+    if (!tmp.is_open()) return false;
+    tmp << out.str();
+    tmp.close();
+    return rename(tmp_path.c_str(), config_file.c_str()) == 0;
+}
+
+// 单独拟合所需的最少按压次数，少于此数的按键合并到全局参数中拟合
+#define MIN_KEY_SAMPLES 20
+
+// 按键级参数在配置中的键名：沿用配置中已有的写法（按键码或名称），没有时用按键名称
+static std::string key_param(const char* param, int code) {
+    std::string prefix = std::string(param) + "_";
+    for (auto it = g_config.lower_bound(prefix); it != g_config.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+        std::string rest = it->first.substr(prefix.size());
+        int parsed = (!rest.empty() && rest[0] >= '0' && rest[0] <= '9') ? atoi(rest.c_str()) : key_code(rest);
+        if (parsed == code) return it->first;
+    }
+    const char* name = key_name(code);
+    return prefix + (name ? name : std::to_string(code));
+}
+
+// 拟合一组按键序列的阈值并写入suggested：param_key给出参数在配置中的键名，
+// default_*为该键名未设置时生效的值（按键级参数沿用全局参数，全局参数沿用kctrl的默认值）
+template <typename ParamKey>
+static void fit_group(const std::vector<const std::vector<PressSample>*>& seqs, ParamKey param_key,
+                      int default_click, int default_long, double target, std::map<std::string, int>& suggested) {
+    // 按压时长聚类：点击 / 短按 / 长按
+    std::vector<double> durations;
+    for (const auto* seq : seqs) {
+        for (const auto& s : *seq) durations.push_back((s.release_us - s.press_us) / 1000.0);
+    }
+    if (durations.size() < 3) {
+        std::cout << "  Not enough samples (" << durations.size() << "), thresholds unchanged" << std::endl;
+        return;
+    }
+    // 先分出多于手势类别数的簇（按分位数初始化时，占多数的点击会分走多个中心），
+    // 未明显分开的相邻簇合并后，按中位数相对当前阈值归为点击/短按/长按；
+    // 只在两类都有样本时拟合其间的阈值，缺少的手势类别保持当前值
+    auto duration_clusters = cluster_log_kmeans(durations, 6);
+    merge_close_clusters(duration_clusters);
+    std::string click_key = param_key("click_threshold");
+    std::string long_key = param_key("long_press_threshold");
+    std::string double_key = param_key("double_click_interval");
+    int current_click = config_int(click_key, default_click);
+    int current_long = config_int(long_key, default_long);
+    static const char* class_names[] = { "click", "short", "long" };
+    std::vector<double> classes[3];  // 点击、短按、长按
+    std::cout << "  Press duration clusters (ms):" << std::endl;
+    for (const auto& c : duration_clusters) {
+        double median = sorted_quantile(c, 0.5);
+        int cls = median <= current_click ? 0 : (median < current_long ? 1 : 2);
+        classes[cls].insert(classes[cls].end(), c.begin(), c.end());
+        std::cout << "    " << class_names[cls] << ": n=" << c.size() << " min=" << c.front() << " p50=" << median
+                  << " max=" << c.back() << std::endl;
+    }
+    
+    int click_threshold = current_click;
+    const std::vector<double>& above_click = classes[1].empty() ? classes[2] : classes[1];
+    if (!classes[0].empty() && !above_click.empty()) {
+        click_threshold = fit_boundary(classes[0], above_click, target);
+        suggested[click_key] = click_threshold;
+        std::cout << "  " << click_key << "=" << click_threshold << " (misclassified: "
+                  << misclassification_rate(classes[0], above_click, click_threshold) * 100 << "%)" << std::endl;
+    } else {
+        std::cout << "  No " << (classes[0].empty() ? "click" : "short/long") << " presses recorded, " << click_key
+                  << "=" << current_click << " unchanged" << std::endl;
+    }
+    if (!classes[1].empty() && !classes[2].empty()) {
+        // kctrl中不低于long_press_threshold为长按，其余非点击为短按
+        int long_threshold = fit_boundary(classes[1], classes[2], target);
+        suggested[long_key] = long_threshold;
+        std::cout << "  " << long_key << "=" << long_threshold << " (misclassified: "
+                  << misclassification_rate(classes[1], classes[2], long_threshold) * 100 << "%)" << std::endl;
+    } else {
+        std::cout << "  No " << (classes[1].empty() ? "short" : "long") << " presses recorded, " << long_key
+                  << "=" << current_long << " unchanged" << std::endl;
+    }
+    
+    // 连击间隔：同一按键相邻两次点击的释放时间差（双击窗口需要覆盖第二次点击的释放）
+    // 间隔须明显分为双击内与单击之间两簇才拟合，否则（如只有零散的单击）保持当前值
+    std::vector<double> intervals;
+    for (const auto* seq : seqs) {
+        for (size_t i = 1; i < seq->size(); i++) {
+            const PressSample& prev = (*seq)[i - 1];
+            const PressSample& cur = (*seq)[i];
+            if ((prev.release_us - prev.press_us) / 1000.0 > click_threshold ||
+                (cur.release_us - cur.press_us) / 1000.0 > click_threshold) continue;
+            intervals.push_back((cur.release_us - prev.release_us) / 1000.0);
+        }
+    }
+    auto interval_clusters = cluster_log_kmeans(intervals, 2);
+    merge_close_clusters(interval_clusters);
+    int double_interval = interval_clusters.size() == 2 ?
+                          fit_boundary(interval_clusters[0], interval_clusters[1], target) : 0;
+    if (double_interval > 0 && double_interval <= MAX_DOUBLE_CLICK_INTERVAL) {
+        suggested[double_key] = double_interval;
+        std::cout << "  " << double_key << "=" << double_interval << " (from " << intervals.size()
+                  << " tap interval(s))" << std::endl;
+    } else {
+        std::cout << "  No clear double clicks among " << intervals.size() << " tap interval(s), "
+                  << double_key << " unchanged" << std::endl;
+    }
+}
+
+// 在指定时长内记录按键时序并输出建议阈值，apply为true时写回配置文件
+static int run_learn(std::vector<WatchedDevice>& devices, int duration_sec, double target,
+                     bool apply, const std::string& config_file) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        LOGE("epoll_create1 failed: %s", strerror(errno));
+        return 1;
+    }
+    for (size_t i = 0; i < devices.size(); i++) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = static_cast<uint32_t>(i);
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, devices[i].fd, &ev);
+    }
+    
+    std::cout << "Learning for " << duration_sec << "s: use your keys normally - single clicks, double clicks,"
+              << " short and long presses (Ctrl+C to finish early)..." << std::endl;
+    
+    // 每个按键的按下/释放记录（内核时间戳，微秒）
+    std::map<int, std::vector<PressSample>> samples;
+    std::map<int, uint64_t> pressed_at;
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int64_t now_ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    int64_t deadline_ms = now_ms + duration_sec * 1000LL;
+    struct epoll_event ready[16];
+    struct input_event events[64];
+    while (g_running && now_ms < deadline_ms) {
+        int n = epoll_wait(epoll_fd, ready, sizeof(ready) / sizeof(ready[0]), static_cast<int>(deadline_ms - now_ms));
+        for (int i = 0; i < n; i++) {
+            ssize_t bytes = read(devices[ready[i].data.u32].fd, events, sizeof(events));
+            if (bytes <= 0) {
+                if (bytes == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, devices[ready[i].data.u32].fd, nullptr);
+                continue;
+            }
+            for (size_t j = 0; j < bytes / sizeof(struct input_event); j++) {
+                const struct input_event& event = events[j];
+                if (event.type != EV_KEY) continue;
+                uint64_t event_us = static_cast<uint64_t>(event.input_event_sec) * 1000000ULL + event.input_event_usec;
+                if (event.value == 1) {
+                    pressed_at[event.code] = event_us;
+                } else if (event.value == 0) {
+                    auto it = pressed_at.find(event.code);
+                    if (it == pressed_at.end()) continue;
+                    samples[event.code].push_back({it->second, event_us});
+                    std::cout << "  " << get_key_name(event.code) << " (" << event.code << "): "
+                              << (event_us - it->second) / 1000 << "ms" << std::endl;
+                    pressed_at.erase(it);
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now_ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    }
+    close(epoll_fd);
+    for (auto& dev : devices) {
+        close(dev.fd);
+        dev.fd = -1;
+    }
+    
+    size_t total = 0;
+    for (const auto& pair : samples) total += pair.second.size();
+    if (total < 3) {
+        std::cerr << "Not enough samples (" << total << "), press keys more during learning" << std::endl;
+        return 1;
+    }
+    
+    // 样本足够的按键单独拟合，写按键级参数<参数>_<按键>；其余按键的样本合并后拟合全局参数
+    std::map<std::string, int> suggested;
+    int global_click = config_int("click_threshold", 200);
+    int global_long = config_int("long_press_threshold", 1000);
+    std::vector<const std::vector<PressSample>*> sparse;
+    size_t sparse_count = 0;
+    for (const auto& pair : samples) {
+        if (pair.second.size() < MIN_KEY_SAMPLES) {
+            sparse.push_back(&pair.second);
+            sparse_count += pair.second.size();
+            continue;
+        }
+        int code = pair.first;
+        std::cout << get_key_name(code) << " (" << code << "), " << pair.second.size() << " presses:" << std::endl;
+        fit_group({ &pair.second }, [code](const char* param) { return key_param(param, code); },
+                  global_click, global_long, target, suggested);
+    }
+    if (!sparse.empty()) {
+        std::cout << (sparse.size() == samples.size() ? "All keys" : "Other keys") << " (pooled, "
+                  << sparse_count << " presses, fewer than " << MIN_KEY_SAMPLES << " per key):" << std::endl;
+        fit_group(sparse, [](const char* param) { return std::string(param); }, 200, 1000, target, suggested);
+    }
+    
+    if (apply && suggested.empty()) {
+        std::cout << "No thresholds fitted, " << config_file << " unchanged" << std::endl;
+    } else if (apply) {
+        if (apply_thresholds(config_file, suggested)) {
+            std::cout << "Thresholds written to " << config_file << std::endl;
+            LOGI("Learned thresholds applied to %s", config_file.c_str());
+        } else {
+            std::cerr << "Error: Failed to update " << config_file << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 输出用法说明
+static void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [-c|--continuous] [-o|--output <file|->] [config_file]" << std::endl;
+    std::cerr << "       " << prog << " -p|--profile <seconds> [-a|--all] [config_file]" << std::endl;
+    std::cerr << "       " << prog << " -l|--learn <seconds> [-t|--target <rate>] [--apply] [config_file]" << std::endl;
+    std::cerr << "Default config file: /data/adb/modules/kctrl/config.txt" << std::endl;
+}
+
 int main(int argc, char* argv[]) {
     LOGI("KFIND v2.4 started - Key finder utility");
     LOGI("Author: IDlike");
@@ -326,10 +899,37 @@ int main(int argc, char* argv[]) {
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
-    // 确定配置文件路径
+    // 解析命令行参数
     std::string config_file = "/data/adb/modules/kctrl/config.txt";
-    if (argc > 1) {
-        config_file = argv[1];
+    bool continuous = false;
+    std::string stream_path;
+    int profile_seconds = 0;
+    bool all_devices = false;
+    int learn_seconds = 0;
+    double learn_target = 0.02;
+    bool learn_apply = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-c" || arg == "--continuous") {
+            continuous = true;
+        } else if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+            stream_path = argv[++i];
+        } else if ((arg == "-p" || arg == "--profile") && i + 1 < argc) {
+            profile_seconds = atoi(argv[++i]);
+        } else if (arg == "-a" || arg == "--all") {
+            all_devices = true;
+        } else if ((arg == "-l" || arg == "--learn") && i + 1 < argc) {
+            learn_seconds = atoi(argv[++i]);
+        } else if ((arg == "-t" || arg == "--target") && i + 1 < argc) {
+            learn_target = atof(argv[++i]);
+        } else if (arg == "--apply") {
+            learn_apply = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            config_file = arg;
+        }
     }
     
     // 设置配置文件目录
@@ -340,27 +940,32 @@ int main(int argc, char* argv[]) {
         g_config_dir = "./";
     }
     
-    // 加载配置
-    if (!load_config(config_file)) {
-        std::cerr << "Usage: " << argv[0] << " [config_file]" << std::endl;
-        std::cerr << "Default config file: /data/adb/modules/kctrl/config.txt" << std::endl;
-        return 1;
-    }
-    
-    // 获取设备路径
-    auto device_it = g_config.find("device");
-    if (device_it == g_config.end()) {
-        LOGE("Device path not found in config");
-        std::cerr << "Error: 'device' not found in config file" << std::endl;
-        std::cerr << "Please add a line like: device=/dev/input/event0" << std::endl;
-        return 1;
-    }
-    
-    std::string devices_config = device_it->second;
-    LOGI("Device config: %s", devices_config.c_str());
+    std::vector<std::string> device_paths;
+    if (all_devices) {
+        // 监听 /dev/input 下的全部 event 设备，无需配置文件
+        device_paths = list_event_devices_kf();
+    } else {
+        // 加载配置
+        if (!load_config(config_file)) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        
+        // 获取设备路径
+        auto device_it = g_config.find("device");
+        if (device_it == g_config.end()) {
+            LOGE("Device path not found in config");
+            std::cerr << "Error: 'device' not found in config file" << std::endl;
+            std::cerr << "Please add a line like: device=/dev/input/event0" << std::endl;
+            return 1;
+        }
+        
+        std::string devices_config = device_it->second;
+        LOGI("Device config: %s", devices_config.c_str());
 
-    // 新增：名称/通配符解析
-    std::vector<std::string> device_paths = resolve_device_config_kf(devices_config);
+        // 新增：名称/通配符解析
+        device_paths = resolve_device_config_kf(devices_config);
+    }
 
     if (device_paths.empty()) {
         LOGE("No valid device paths found");
@@ -379,25 +984,56 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    // 为每个设备启动独立的监听线程
-    std::vector<std::thread> monitor_threads;
-    monitor_threads.reserve(device_paths.size());
+    // 打开所有设备，由单个epoll循环监听
+    std::vector<WatchedDevice> devices;
+    devices.reserve(device_paths.size());
     for (const auto& device_path : device_paths) {
-        monitor_threads.emplace_back(monitor_input_device, device_path);
+        clockid_t clock = CLOCK_MONOTONIC;
+        int fd = open_input_device(device_path, clock);
+        if (fd != -1) devices.push_back({device_path, fd, clock});
+    }
+    if (devices.empty()) {
+        std::cerr << "Error: No device could be opened" << std::endl;
+        return 1;
+    }
+    
+    // 分析模式：统计指定时长后输出报告并退出
+    if (profile_seconds > 0) {
+        int result = run_profile(devices, profile_seconds);
+        LOGI("KFIND stopped");
+        return result;
     }
     
-    // 主循环 - 等待程序退出
-    {
-        std::unique_lock<std::mutex> lock(g_output_mutex);
-        g_shutdown_cv.wait(lock, []{ return !g_running; });
+    // 学习模式：拟合建议阈值，可选写回配置文件
+    if (learn_seconds > 0) {
+        if (learn_target <= 0 || learn_target >= 0.5) learn_target = 0.02;
+        int result = run_learn(devices, learn_seconds, learn_target, learn_apply, config_file);
+        LOGI("KFIND stopped");
+        return result;
     }
     
-    // 等待所有监听线程结束
-    for (auto& thread : monitor_threads) {
-        if (thread.joinable()) {
-            thread.join();
+    // 连续模式：事件记录写入一个带缓冲的输出流（默认kfind.txt，"-"表示标准输出）
+    FILE* stream_out = nullptr;
+    static char stream_buffer[64 * 1024];
+    if (continuous) {
+        if (stream_path.empty()) stream_path = g_config_dir + "kfind.txt";
+        stream_out = (stream_path == "-") ? stdout : fopen(stream_path.c_str(), "w");
+        if (!stream_out) {
+            std::cerr << "Error: Cannot open output " << stream_path << ": " << strerror(errno) << std::endl;
+            return 1;
         }
+        setvbuf(stream_out, stream_buffer, _IOFBF, sizeof(stream_buffer));
+        std::cout << "Streaming key events to " << stream_path << " (Ctrl+C to stop)" << std::endl;
+        LOGI("Streaming key events to %s", stream_path.c_str());
+    }
+    
+    int result = run_capture(devices, continuous, stream_out);
+    
+    if (stream_out) {
+        fflush(stream_out);
+        if (stream_out != stdout) fclose(stream_out);
     }
+    if (result != 0) return result;
     
     std::cout << "KFIND stopped." << std::endl;
     LOGI("KFIND stopped");
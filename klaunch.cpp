@@ -8,13 +8,67 @@
 #include <cstring>
 #include <fcntl.h>
 #include <sys/resource.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <time.h>
 #include <errno.h>
 
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434  // 所有架构统一的系统调用号（Linux 5.3+）
+#endif
+
 // 日志宏定义
 #define LOG_TAG "KLAUNCH"
 #define LOGI(...) printf("[INFO][" LOG_TAG "] " __VA_ARGS__); printf("\n")
 #define LOGE(...) printf("[ERROR][" LOG_TAG "] " __VA_ARGS__); printf("\n")
 
+// 重定向标准输入输出到/dev/null
+static void redirect_stdio_to_null() {
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd != -1) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if (null_fd > 2) {
+            close(null_fd);
+        }
+    }
+}
+
+// 在当前（子）进程中执行目标程序，不返回
+// ready_fd >= 0 时通过环境变量KCTRL_READY_FD传给目标程序，用于就绪通知
+[[noreturn]] static void exec_disguised(const std::string& executable_path, int ready_fd) {
+    redirect_stdio_to_null();
+    
+    // 清理环境变量以减少痕迹
+    clearenv();
+    if (ready_fd >= 0) {
+        char value[16];
+        snprintf(value, sizeof(value), "%d", ready_fd);
+        setenv("KCTRL_READY_FD", value, 1);
+    }
+    
+    // 设置最低优先级以减少系统影响
+    nice(19);
+    
+    // 忽略一些信号
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+    signal(SIGINT, SIG_IGN);
+    
+    // 执行目标程序 - 使用隐蔽的进程名
+    // 将进程名伪装成系统进程
+    const char* disguised_name = "[kthreadd]";
+    execl(executable_path.c_str(), disguised_name, (char*)NULL);
+    
+    // 如果execl失败，程序会继续执行到这里
+    LOGE("Failed to execute %s: %s", executable_path.c_str(), strerror(errno));
+    exit(1);
+}
+
 // 无痕启动程序
 bool launch_stealth(const std::string& executable_path) {
     pid_t pid = fork();
@@ -46,49 +100,311 @@ bool launch_stealth(const std::string& executable_path) {
         }
         
         // 第二个子进程（孙进程）
+        exec_disguised(executable_path, -1);
+    } else {
+        // 父进程
+        
+        // 等待第一个子进程退出
+        int status;
+        waitpid(pid, &status, 0);
         
+        LOGI("Successfully launched %s in stealth mode", executable_path.c_str());
+        return true;
+    }
+}
+
+// 监护模式：klaunch常驻为一个很小的父进程，用pidfd等待目标程序，异常退出后按指数退避重启
+// 目标程序就绪（kctrl为设备接入完成）后向KCTRL_READY_FD写入"<pid>\n"；
+// 升级后新进程写入自己的pid，旧进程退出时改为监视新进程，不重启
+#define READY_TIMEOUT_MS 10000  // 前台klaunch等待首次就绪的时间
+#define BACKOFF_MIN_MS 50       // 启动后很快退出时的首次重启延迟，之后每次加倍
+#define BACKOFF_MAX_MS 30000
+#define STABLE_RUN_MS 10000     // 就绪后运行超过该时间再退出视为偶发崩溃，立即重启并复位退避
+#define STOP_TIMEOUT_MS 3000    // 停止监护时等待目标程序退出的时间，超时后SIGKILL
+
+static uint64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int pidfd_open(pid_t pid) {
+    return static_cast<int>(syscall(__NR_pidfd_open, pid, 0));
+}
 
-        // 重定向标准输入输出到/dev/null
-        int null_fd = open("/dev/null", O_RDWR);
-        if (null_fd != -1) {
-            dup2(null_fd, STDIN_FILENO);
-            dup2(null_fd, STDOUT_FILENO);
-            dup2(null_fd, STDERR_FILENO);
-            if (null_fd > 2) {
-                close(null_fd);
+// 向前台klaunch报告首次启动结果：'R'就绪，'F'失败
+static void report_status(int& status_fd, char result) {
+    if (status_fd == -1) return;
+    if (write(status_fd, &result, 1) != 1) {
+        // 前台已超时退出，忽略
+    }
+    close(status_fd);
+    status_fd = -1;
+}
+
+// 读取就绪管道，返回最后一个完整行中的pid（没有新数据时返回0），管道关闭时把fd置为-1
+static pid_t read_ready_pipe(int& ready_fd) {
+    pid_t pid = 0;
+    char buf[128];
+    while (ready_fd != -1) {
+        ssize_t n = read(ready_fd, buf, sizeof(buf) - 1);
+        if (n > 0) {
+            buf[n] = '\0';
+            for (char* line = buf; *line; ) {
+                char* end = strchr(line, '\n');
+                if (!end) break;
+                *end = '\0';
+                if (atoi(line) > 0) pid = atoi(line);
+                line = end + 1;
             }
+        } else if (n == 0) {
+            close(ready_fd);
+            ready_fd = -1;
+        } else {
+            break;  // EAGAIN
         }
+    }
+    return pid;
+}
+
+// 回收所有已退出的子进程（监护进程是subreaper，目标程序遗留的孤儿进程也会挂到这里），
+// 返回serving是否在其中
+static bool reap_children(pid_t serving, int& serving_status) {
+    bool exited = false;
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == serving) {
+            serving_status = status;
+            exited = true;
+        }
+    }
+    return exited;
+}
+
+// 停止目标程序：先SIGTERM，超时后SIGKILL
+static void stop_serving(pid_t serving, int pidfd) {
+    kill(serving, SIGTERM);
+    uint64_t deadline = monotonic_ms() + STOP_TIMEOUT_MS;
+    while (kill(serving, 0) == 0) {
+        uint64_t now = monotonic_ms();
+        if (now >= deadline) {
+            kill(serving, SIGKILL);
+            break;
+        }
+        if (pidfd != -1) {
+            struct pollfd pfd = { pidfd, POLLIN, 0 };
+            poll(&pfd, 1, static_cast<int>(deadline - now));
+        } else {
+            usleep(10000);
+        }
+        int status;
+        waitpid(serving, &status, WNOHANG);
+    }
+    int status;
+    waitpid(serving, &status, WNOHANG);
+}
+
+// 监护循环，返回进程退出码
+static int run_supervisor(const std::string& executable_path, int status_fd) {
+    prctl(PR_SET_CHILD_SUBREAPER, 1);  // 升级时旧进程fork出的新进程在旧进程退出后由本进程收养
+    redirect_stdio_to_null();
+    
+    sigset_t mask, empty;
+    sigemptyset(&mask);
+    sigemptyset(&empty);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int sfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sfd == -1) {
+        LOGE("signalfd failed: %s", strerror(errno));
+        report_status(status_fd, 'F');
+        return 1;
+    }
+    
+    uint32_t backoff_ms = 0;
+    unsigned restarts = 0;
+    while (true) {
+        int ready_pipe[2];
+        if (pipe2(ready_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+            LOGE("pipe2 failed: %s", strerror(errno));
+            report_status(status_fd, 'F');
+            return 1;
+        }
+        uint64_t started_ms = monotonic_ms();
+        pid_t child = fork();
+        if (child == 0) {
+            sigprocmask(SIG_SETMASK, &empty, NULL);
+            fcntl(ready_pipe[1], F_SETFL, 0);         // 写端对目标程序保持阻塞语义
+            fcntl(ready_pipe[1], F_SETFD, 0);         // 只有写端跨越exec
+            exec_disguised(executable_path, ready_pipe[1]);
+        }
+        close(ready_pipe[1]);
+        int ready_fd = ready_pipe[0];
         
-        // 清理环境变量以减少痕迹
-        clearenv();
-        
-        // 设置最低优先级以减少系统影响
-        nice(19);
-        
-        // 忽略一些信号
-        signal(SIGCHLD, SIG_IGN);
-        signal(SIGHUP, SIG_IGN);
-        signal(SIGTERM, SIG_IGN);
-        signal(SIGINT, SIG_IGN);
+        pid_t serving = child;
+        int serving_status = -1;
+        int pidfd = (child > 0) ? pidfd_open(child) : -1;  // 内核不支持时退回到SIGCHLD
+        bool ready = false;
+        bool stop = false;
+        uint64_t ready_ms = 0;
+        pid_t announced = 0;
+        if (child == -1) {
+            LOGE("Failed to fork: %s", strerror(errno));
+        }
         
-        // 执行目标程序 - 使用隐蔽的进程名
-        // 将进程名伪装成系统进程
-        const char* disguised_name = "[kthreadd]";
-        execl(executable_path.c_str(), disguised_name, (char*)NULL);
+        while (child > 0) {
+            struct pollfd fds[3] = {
+                { sfd, POLLIN, 0 },
+                { ready_fd, POLLIN, 0 },  // 为-1时poll忽略该项
+                { pidfd, POLLIN, 0 },
+            };
+            if (poll(fds, 3, -1) == -1) {
+                if (errno == EINTR) continue;
+                LOGE("poll failed: %s", strerror(errno));
+                stop = true;
+                break;
+            }
+            
+            bool exited = false;
+            if (fds[1].revents) {
+                pid_t pid = read_ready_pipe(ready_fd);
+                if (pid > 0) {
+                    announced = pid;
+                    if (!ready) {
+                        ready = true;
+                        ready_ms = monotonic_ms();
+                        report_status(status_fd, 'R');
+                    }
+                }
+            }
+            if (fds[0].revents) {
+                struct signalfd_siginfo info;
+                while (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+                    if (info.ssi_signo != SIGCHLD) stop = true;
+                }
+                if (stop) {
+                    stop_serving(serving, pidfd);
+                    break;
+                }
+                exited = reap_children(serving, serving_status);
+            }
+            if (fds[2].revents) {
+                exited = true;
+                int status;
+                if (waitpid(serving, &status, WNOHANG) == serving) serving_status = status;
+            }
+            if (!exited) continue;
+            
+            // 新进程在旧进程退出前已写入自己的pid：这是一次升级，改为监视新进程
+            pid_t pid = read_ready_pipe(ready_fd);
+            if (pid > 0) announced = pid;
+            if (announced > 0 && announced != serving && kill(announced, 0) == 0) {
+                serving = announced;
+                serving_status = -1;
+                if (pidfd != -1) close(pidfd);
+                pidfd = pidfd_open(serving);
+                continue;
+            }
+            break;
+        }
+        if (pidfd != -1) close(pidfd);
+        if (ready_fd != -1) close(ready_fd);
+        if (stop) {
+            report_status(status_fd, 'F');
+            return 0;
+        }
         
-        // 如果execl失败，程序会继续执行到这里
-        LOGE("Failed to execute %s: %s", executable_path.c_str(), strerror(errno));
-        exit(1);
-    } else {
-        // 父进程
+        // 正常退出（例如收到终止信号后清理退出）不重启
+        if (serving_status != -1 && WIFEXITED(serving_status) && WEXITSTATUS(serving_status) == 0) {
+            report_status(status_fd, ready ? 'R' : 'F');
+            return 0;
+        }
+        report_status(status_fd, 'F');
         
-        // 等待第一个子进程退出
-        int status;
-        waitpid(pid, &status, 0);
+        // 就绪后稳定运行过的进程立即重启；启动即失败的按指数退避，避免崩溃循环占满CPU
+        if (ready && monotonic_ms() - ready_ms >= STABLE_RUN_MS) {
+            backoff_ms = 0;
+        } else {
+            backoff_ms = backoff_ms ? backoff_ms * 2 : BACKOFF_MIN_MS;
+            if (backoff_ms > BACKOFF_MAX_MS) backoff_ms = BACKOFF_MAX_MS;
+        }
+        restarts++;
+        LOGI("Child %d exited (status 0x%x, ran %llums), restart #%u in %ums", serving, serving_status,
+             (unsigned long long)(monotonic_ms() - started_ms), restarts, backoff_ms);
         
-        LOGI("Successfully launched %s in stealth mode", executable_path.c_str());
+        // 退避期间仍响应终止信号并回收子进程
+        uint64_t resume_ms = monotonic_ms() + backoff_ms;
+        while (true) {
+            uint64_t now = monotonic_ms();
+            if (now >= resume_ms) break;
+            struct pollfd pfd = { sfd, POLLIN, 0 };
+            if (poll(&pfd, 1, static_cast<int>(resume_ms - now)) <= 0) continue;
+            struct signalfd_siginfo info;
+            while (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+                if (info.ssi_signo != SIGCHLD) return 0;
+            }
+            int status;
+            reap_children(-1, status);
+        }
+    }
+}
+
+// 以监护模式启动：脱离终端后常驻监护目标程序，前台等待首次就绪后返回
+bool launch_supervised(const std::string& executable_path) {
+    int status_pipe[2];
+    if (pipe2(status_pipe, O_CLOEXEC) == -1) {
+        LOGE("Failed to create pipe: %s", strerror(errno));
+        return false;
+    }
+    
+    fflush(stdout);  // 避免缓冲中的输出在子进程中重复
+    pid_t pid = fork();
+    if (pid == -1) {
+        LOGE("Failed to fork process: %s", strerror(errno));
+        return false;
+    }
+    
+    if (pid == 0) {
+        // 与launch_stealth相同：新会话 + 二次fork，监护进程为孙进程
+        close(status_pipe[0]);
+        if (setsid() == -1) {
+            LOGE("Failed to create new session: %s", strerror(errno));
+            exit(1);
+        }
+        pid_t pid2 = fork();
+        if (pid2 == -1) {
+            LOGE("Failed to fork second time: %s", strerror(errno));
+            exit(1);
+        }
+        if (pid2 > 0) {
+            exit(0);
+        }
+        exit(run_supervisor(executable_path, status_pipe[1]));
+    }
+    
+    close(status_pipe[1]);
+    int status;
+    waitpid(pid, &status, 0);
+    
+    // 等待目标程序就绪
+    char result = 0;
+    struct pollfd pfd = { status_pipe[0], POLLIN, 0 };
+    if (poll(&pfd, 1, READY_TIMEOUT_MS) > 0 && read(status_pipe[0], &result, 1) != 1) result = 0;
+    close(status_pipe[0]);
+    if (result == 'R') {
+        LOGI("Successfully launched %s under supervision", executable_path.c_str());
         return true;
     }
+    if (result == 'F') {
+        LOGE("%s exited before becoming ready, supervisor keeps retrying", executable_path.c_str());
+    } else {
+        LOGE("%s not ready after %dms, supervisor keeps waiting", executable_path.c_str(), READY_TIMEOUT_MS);
+    }
+    return false;
 }
 
 // 检查文件是否存在且可执行
@@ -100,13 +416,16 @@ int main(int argc, char* argv[]) {
     LOGI("KLAUNCH v2.4 - Stealth Process Launcher");
     LOGI("Author: IDlike");
     
-    if (argc != 2) {
-        LOGE("Usage: %s <executable_path>", argv[0]);
+    // 监护模式：klaunch --supervise <executable_path>
+    bool supervise = argc == 3 && strcmp(argv[1], "--supervise") == 0;
+    if (argc != 2 && !supervise) {
+        LOGE("Usage: %s [--supervise] <executable_path>", argv[0]);
         LOGE("Example: %s /system/bin/sh", argv[0]);
+        LOGE("  --supervise: stay resident, restart the program when it crashes, and return once it is ready");
         return 1;
     }
     
-    std::string executable_path = argv[1];
+    std::string executable_path = argv[argc - 1];
     
     // 检查文件是否存在且可执行
     if (!is_executable(executable_path)) {
@@ -116,7 +435,7 @@ int main(int argc, char* argv[]) {
     
     LOGI("Launching: %s", executable_path.c_str());
     
-    if (launch_stealth(executable_path)) {
+    if (supervise ? launch_supervised(executable_path) : launch_stealth(executable_path)) {
         LOGI("Process launched successfully in stealth mode");
         return 0;
     } else {
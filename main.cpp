@@ -14,13 +14,32 @@
 #include <condition_variable>
 #include <vector>
 #include <unordered_map>
-#include <fstream>
 #include <cstdarg>
 #include <sys/resource.h>
 #include <sched.h>
 #include <sys/mman.h>
 #include <dirent.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <time.h>
+#include <linux/uinput.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <string_view>
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cmath>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include <poll.h>
+#include "keycodes.h"
+#include "gesture.h"
 #include <android/log.h>
 #include <cstdlib>
 #include <cstdio>
@@ -29,14 +48,26 @@
 #include <condition_variable>
 #include <vector>
 #include <unordered_map>
-#include <fstream>
 #include <cstdarg>
 #include <sys/resource.h>
 #include <sched.h>
 #include <sys/mman.h>
 
 #define LOG_TAG "KCTRL"
-#define LOG_FILE "/data/adb/modules/kctrl/klog.log"
+// 日志、统计、PID文件、脚本目录与飞行记录均位于数据目录下，默认为模块目录；
+// 环境变量KCTRL_DATA_DIR可指定其他目录，压力测试的被测实例借此使用临时目录，不覆盖正在使用的文件
+#define MODULE_DIR "/data/adb/modules/kctrl"
+#define DATA_DIR_ENV "KCTRL_DATA_DIR"
+#define LOG_FILE "klog.log"
+#define STATS_FILE "kstats.txt"
+#define PID_FILE "mpid.txt"
+#define SCRIPTS_DIR "scripts"
+#define FLIGHT_FILE "kflight.bin"
+static std::string g_data_dir = MODULE_DIR;  // 启动时确定，之后只读
+
+static inline std::string data_path(const char* name) {
+    return g_data_dir + "/" + name;
+}
 
 // 日志文件输出函数 - 内存优化版本
 void write_log_to_file(const char* level, const char* format, ...) {
@@ -57,7 +88,7 @@ void write_log_to_file(const char* level, const char* format, ...) {
              tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
     
     // 使用C风格文件操作减少开销
-    FILE* logfile = fopen(LOG_FILE, "a");
+    FILE* logfile = fopen(data_path(LOG_FILE).c_str(), "a");
     if (logfile) {
         fprintf(logfile, "[%s][%s] %s\n", time_buffer, level, buffer);
         fclose(logfile);
@@ -85,78 +116,326 @@ void write_log_to_file(const char* level, const char* format, ...) {
     } \
 } while(0)
 
-// 按键状态结构体 - 极致内存优化版本
-struct KeyState {
-    uint64_t press_time_ns;      // 纳秒时间戳，8字节
-    uint64_t last_click_time_ns; // 纳秒时间戳，8字节
-    uint8_t flags;               // 位域：bit0=is_pressed, bit1=timer_active, bit2-7=click_count
-    std::thread timer_thread;
-    
-    KeyState() : press_time_ns(0), last_click_time_ns(0), flags(0) {}
-    
-    inline bool is_pressed() const { return flags & 1; }
-    inline void set_pressed(bool pressed) { 
-        flags = pressed ? (flags | 1) : (flags & 0xFE); 
-    }
-    inline bool timer_active() const { return flags & 2; }
-    inline void set_timer_active(bool active) {
-        flags = active ? (flags | 2) : (flags & 0xFD);
-    }
-    inline uint8_t click_count() const { return (flags >> 2) & 0x3F; }
-    inline void set_click_count(uint8_t count) { 
-        flags = (flags & 3) | ((count & 0x3F) << 2); 
-    }
+struct InputDevice;
+
+// 具名唤醒锁：仅在手势窗口打开或动作执行期间持有，引用计数并统计持有时间
+struct WakeSource {
+    const char* name;
+    int refcount;
+    uint64_t acquire_count;   // 实际写入wake_lock的次数
+    uint64_t held_ns_total;   // 累计持有时间
+    uint64_t acquired_at_ns;  // 本次持有的起始时间
 };
 
 // 全局变量 - 极致内存优化版本
 static std::atomic<bool> g_running{true};
 static int g_wakelock_fd = -1;
+static int g_wakeunlock_fd = -1;
+static WakeSource g_gesture_wake = { "kctrl_gesture", 0, 0, 0, 0 };
+static WakeSource g_action_wake = { "kctrl_action", 0, 0, 0, 0 };
+static std::mutex g_wake_mutex;
+// 升级交接后唤醒锁由新进程持有（内核按名称管理），旧进程只维护计数，不再写入wake_lock/wake_unlock
+static bool g_wake_detached = false;
 
-// 使用预分配的小容量容器减少内存碎片
-static std::unordered_map<std::string, std::string> g_config;
-static std::unordered_map<int, KeyState> g_key_states;
+// 事件循环被唤醒的次数（含EPOLLWAKEUP唤醒）
+static uint64_t g_loop_wakeups = 0;
 
-// 合并互斥锁减少同步开销
-static std::mutex g_global_mutex;
-static std::condition_variable g_shutdown_cv;
+// 手势识别引擎的策略（见gesture.h）：时间取自内核事件时间戳（CLOCK_MONOTONIC），
+// 双击窗口使用事件循环的timerfd，识别出的手势交给动作分发；成员函数在各自依赖的全局变量之后定义
+struct KernelClock {
+    uint64_t now_ns();
+};
+struct LoopTimer {
+    void arm(uint64_t deadline_ns);
+};
+struct LoopDispatcher {
+    GestureTiming timing(const InputDevice& dev, uint16_t code);
+    void dispatch(uint16_t code, GestureId gesture, uint32_t duration_ms, uint8_t clicks,
+                  uint64_t time_ns, uint64_t due_ns, const InputDevice* device);
+    void pressed(uint16_t code);
+    void classified(uint16_t code, int32_t gesture, uint32_t duration_ms, uint64_t time_ns);
+    void timer_fired(uint16_t code, uint8_t clicks);
+    void bounced(uint16_t code, bool merged, uint64_t gap_ns, uint64_t time_ns);
+    void busy(bool busy);
+};
+using LoopGestureEngine = GestureEngine<InputDevice, KernelClock, LoopTimer, LoopDispatcher>;
+
+// 按键状态以(设备槽位, 按键码)为键，使用预分配的小容量容器减少内存碎片
+static LoopGestureEngine g_gestures;
+static std::string g_config_path = "/data/adb/modules/kctrl/config.txt";
 
 // 时间配置参数（毫秒）
 static int g_click_threshold = 200;
-static int g_short_press_threshold = 500;
 static int g_long_press_threshold = 1000;
 static int g_double_click_interval = 300;
 
 // 日志开关配置
 static bool g_enable_log = false;
 
-// 信号处理函数
-void signal_handler(int sig) {
-    if (sig == SIGTERM || sig == SIGINT) {
-        {
-            std::lock_guard<std::mutex> lock(g_global_mutex);
-            g_running = false;
-        }
-        g_shutdown_cv.notify_all();
-        LOGI("Received signal %d, shutting down...", sig);
+// 动作队列上限（action_queue_max）
+static std::atomic<size_t> g_action_queue_max{16};
+
+// 是否通过继承的fd向脚本传递二进制手势上下文（action_context_fd）
+static std::atomic<bool> g_action_context_fd{false};
+
+// 按键重映射（独占设备并通过uinput转发）
+// 映射表在加载配置时编译为按键码直接索引的数组，双缓冲发布，转发路径无锁
+#define REMAP_SUPPRESS KEY_RESERVED  // 映射到0表示吞掉该按键
+static bool g_remap_enabled = false;
+static uint16_t g_remap_tables[2][KEY_CNT];
+static std::atomic<int> g_remap_active{0};
+
+// 重映射统计：转发帧数/事件数/吞掉事件数及内核时间戳到转发完成的延迟
+// 延迟只统计事件时钟为CLOCK_MONOTONIC的设备，g_remap_latency_frames为计入延迟的帧数
+static std::atomic<uint64_t> g_remap_frames{0};
+static std::atomic<uint64_t> g_remap_latency_frames{0};
+static std::atomic<uint64_t> g_remap_events{0};
+static std::atomic<uint64_t> g_remap_suppressed{0};
+static std::atomic<uint64_t> g_remap_latency_ns_total{0};
+static std::atomic<uint64_t> g_remap_latency_ns_max{0};
+
+// 获取CLOCK_MONOTONIC纳秒时间（与输入设备事件时间同一时钟）
+static inline uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// 飞行记录器：固定大小的mmap环形文件，记录紧凑的二进制事件，用于事后复盘误触发
+// 写入只有普通存储与一次原子递增，不产生系统调用；进程崩溃后内容仍保留在文件中
+#define FLIGHT_MAGIC 0x4B464C54u  // "KFLT"
+#define FLIGHT_VERSION 1
+
+enum FlightRecordType : uint8_t {
+    FR_START = 1,      // 守护进程启动，arg=CLOCK_REALTIME纳秒（用于换算墙上时间）
+    FR_EVENT = 2,      // 原始按键事件，code/value同input_event，arg=读取时刻相对事件时间的延迟(ns)
+    FR_CLASSIFY = 3,   // 释放时的分类结果，value=手势，arg=按压时长(ms)
+    FR_TIMER_ARM = 4,  // 双击定时器设置，arg=截止时间(ns)，0表示解除
+    FR_TIMER_FIRE = 5, // 双击定时器到期，code=按键码，value=点击次数
+    FR_DISPATCH = 6,   // 手势分发，value=手势，arg=DispatchResult
+    FR_SPAWN = 7,      // 脚本进程创建，value=pid
+    FR_EXIT = 8,       // 脚本进程退出，value=pid，arg=wait状态
+    FR_RELOAD = 9,     // 配置重载，value=1成功/0失败
+    FR_PROFILE = 10,   // 切换配置方案，value=新方案下标，arg=原方案下标
+    FR_DROP = 11,      // 动作未入队，code=按键码，value=DropReason
+    FR_HANDOFF = 12,   // 升级交接完成（旧进程写入），value=新进程pid，arg=交接耗时(ns)
+    FR_DEBOUNCE = 13,  // 去抖丢弃的抖动，code=按键码，value=1撤销了上次释放的点击/0丢弃按下与释放，arg=距上次释放(ns)
+};
+
+// FR_DISPATCH的arg
+enum DispatchResult : int64_t {
+    DISPATCH_UNBOUND = 0,
+    DISPATCH_BOUND = 1,
+    DISPATCH_GUARDED = 2,  // 有绑定但守卫条件均不成立
+};
+
+// 手势名，同时作为传给脚本的事件类型参数
+static const char* gesture_name(int32_t gesture) {
+    switch (gesture) {
+        case GESTURE_CLICK: return "click";
+        case GESTURE_DOUBLE_CLICK: return "double_click";
+        case GESTURE_SHORT_PRESS: return "short_press";
+        case GESTURE_LONG_PRESS: return "long_press";
+        case GESTURE_CLICK_PENDING: return "click_pending";
+        default: return "unknown";
+    }
+}
+
+struct FlightRecord {
+    uint64_t time_ns;   // CLOCK_MONOTONIC
+    int64_t arg;
+    int32_t value;
+    uint32_t seq;       // 槽位序号+1，写入完成后最后写，解码时用于识别未完成/过期的记录
+    uint16_t code;
+    uint8_t type;
+    uint8_t reserved[5];
+};
+static_assert(sizeof(FlightRecord) == 32, "FlightRecord must stay 32 bytes");
+
+struct FlightHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    std::atomic<uint64_t> head;  // 下一个写入的槽位序号
+    uint64_t reserved[5];
+};
+static_assert(sizeof(FlightHeader) == 64, "FlightHeader must stay 64 bytes");
+
+static FlightHeader* g_flight = nullptr;
+static FlightRecord* g_flight_records = nullptr;
+static size_t g_flight_map_size = 0;
+
+// 写入一条飞行记录（多线程安全，无锁无系统调用）
+static inline void flight_record(uint8_t type, uint16_t code, int32_t value, int64_t arg, uint64_t time_ns = 0) {
+    if (!g_flight) return;
+    uint64_t slot = g_flight->head.fetch_add(1, std::memory_order_relaxed);
+    FlightRecord& r = g_flight_records[slot % g_flight->capacity];
+    __atomic_store_n(&r.seq, 0u, __ATOMIC_RELAXED);
+    r.time_ns = time_ns ? time_ns : monotonic_ns();
+    r.arg = arg;
+    r.value = value;
+    r.code = code;
+    r.type = type;
+    __atomic_store_n(&r.seq, static_cast<uint32_t>(slot + 1), __ATOMIC_RELEASE);
+}
+
+// 打开（或创建）飞行记录文件并映射；容量不变时保留之前的记录
+static bool flight_open(const char* path, size_t capacity) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        LOGE("Failed to open flight recorder %s: %s", path, strerror(errno));
+        return false;
+    }
+    
+    size_t map_size = sizeof(FlightHeader) + capacity * sizeof(FlightRecord);
+    struct stat st;
+    bool reuse = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == map_size;
+    if (!reuse && ftruncate(fd, map_size) == -1) {
+        LOGE("Failed to size flight recorder: %s", strerror(errno));
+        close(fd);
+        return false;
+    }
+    
+    void* map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOGE("Failed to map flight recorder: %s", strerror(errno));
+        return false;
+    }
+    
+    auto* header = static_cast<FlightHeader*>(map);
+    if (!reuse || header->magic != FLIGHT_MAGIC || header->version != FLIGHT_VERSION ||
+        header->record_size != sizeof(FlightRecord) || header->capacity != capacity) {
+        memset(map, 0, map_size);
+        header->magic = FLIGHT_MAGIC;
+        header->version = FLIGHT_VERSION;
+        header->record_size = sizeof(FlightRecord);
+        header->capacity = static_cast<uint32_t>(capacity);
+        header->head.store(0, std::memory_order_relaxed);
+    }
+    
+    g_flight_records = reinterpret_cast<FlightRecord*>(static_cast<char*>(map) + sizeof(FlightHeader));
+    g_flight_map_size = map_size;
+    g_flight = header;
+    
+    struct timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    flight_record(FR_START, 0, getpid(), static_cast<int64_t>(realtime.tv_sec) * 1000000000LL + realtime.tv_nsec);
+    LOGI("Flight recorder: %s (%zu records)", path, capacity);
+    return true;
+}
+
+// 关闭飞行记录器（数据已在共享映射中，munmap前无需显式同步）
+static void flight_close() {
+    if (!g_flight) return;
+    void* map = g_flight;
+    g_flight = nullptr;
+    munmap(map, g_flight_map_size);
+}
+
+// ftrace trace_marker 区间标记：与调度器、I/O事件在同一时间线上对齐kctrl的延迟
+// 关闭时每个标记点只有一次可预测的分支；开启时写入启动时预先格式化好的字符串，无需格式化
+enum TraceSpan {
+    TRACE_READ = 0,     // 读取输入设备并转发
+    TRACE_CLASSIFY,     // 手势识别
+    TRACE_TIMER,        // 双击定时器到期处理
+    TRACE_CONFIG,       // 配置加载与绑定查找
+    TRACE_SPAWN,        // 脚本进程创建
+    TRACE_SPAN_COUNT
+};
+
+static int g_trace_fd = -1;
+static char g_trace_begin[TRACE_SPAN_COUNT][48];
+static size_t g_trace_begin_len[TRACE_SPAN_COUNT];
+static char g_trace_end[24];
+static size_t g_trace_end_len = 0;
+
+#define TRACE_BEGIN(span) do { \
+    if (__builtin_expect(g_trace_fd >= 0, 0)) { \
+        write(g_trace_fd, g_trace_begin[span], g_trace_begin_len[span]); \
+    } \
+} while(0)
+
+#define TRACE_END() do { \
+    if (__builtin_expect(g_trace_fd >= 0, 0)) { \
+        write(g_trace_fd, g_trace_end, g_trace_end_len); \
+    } \
+} while(0)
+
+// 打开trace_marker并预先格式化所有标记（atrace格式 B|pid|name / E|pid）
+static bool trace_open() {
+    static const char* const paths[] = {
+        "/sys/kernel/tracing/trace_marker",
+        "/sys/kernel/debug/tracing/trace_marker",
+    };
+    static const char* const names[TRACE_SPAN_COUNT] = {
+        "kctrl:read", "kctrl:classify", "kctrl:timer", "kctrl:config", "kctrl:spawn",
+    };
+    
+    int fd = -1;
+    for (const char* path : paths) {
+        fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (fd != -1) break;
     }
+    if (fd == -1) {
+        LOGW("Failed to open trace_marker: %s", strerror(errno));
+        return false;
+    }
+    
+    int pid = getpid();
+    for (int i = 0; i < TRACE_SPAN_COUNT; i++) {
+        g_trace_begin_len[i] = snprintf(g_trace_begin[i], sizeof(g_trace_begin[i]), "B|%d|%s", pid, names[i]);
+    }
+    g_trace_end_len = snprintf(g_trace_end, sizeof(g_trace_end), "E|%d", pid);
+    g_trace_fd = fd;
+    LOGI("trace_marker tracing enabled");
+    return true;
+}
+
+// 写入当前进程PID（升级交接后由新进程覆盖）
+static bool write_pid_file() {
+    pid_t current_pid = getpid();
+    std::string pid_file = data_path(PID_FILE);
+    FILE* outfile = fopen(pid_file.c_str(), "w");
+    if (!outfile) {
+        LOGE("Failed to write PID to file");
+        return false;
+    }
+    fprintf(outfile, "%d\n", current_pid);
+    fclose(outfile);
+    LOGI("Process PID %d written to %s", current_pid, pid_file.c_str());
+    return true;
+}
+
+// 读取PID文件，不存在或无效时返回0
+static int read_pid_file() {
+    int pid = 0;
+    FILE* file = fopen(data_path(PID_FILE).c_str(), "r");
+    if (file) {
+        if (fscanf(file, "%d", &pid) != 1) pid = 0;
+        fclose(file);
+    }
+    return pid;
 }
 
 // 检查是否已经运行
 bool check_single_instance() {
-    const char* pidfile = "/data/adb/modules/kctrl/mpid.txt";
+    std::string pid_file = data_path(PID_FILE);
+    const char* pidfile = pid_file.c_str();
     int fd = open(pidfile, O_CREAT | O_WRONLY | O_EXCL, 0644);
     
     if (fd == -1) {
         if (errno == EEXIST) {
             // 检查PID文件中的进程是否还在运行
-            std::ifstream file(pidfile);
-            if (file.is_open()) {
-                pid_t old_pid;
-                file >> old_pid;
-                file.close();
+            FILE* file = fopen(pidfile, "r");
+            if (file) {
+                pid_t old_pid = 0;
+                if (fscanf(file, "%d", &old_pid) != 1) old_pid = 0;
+                fclose(file);
                 
                 // 检查进程是否存在
-                if (kill(old_pid, 0) == 0) {
+                if (old_pid > 0 && kill(old_pid, 0) == 0) {
                     LOGE("Another instance is already running with PID: %d", old_pid);
                     return false;
                 } else {
@@ -171,167 +450,964 @@ bool check_single_instance() {
     }
     
     // 写入当前进程PID
-    pid_t current_pid = getpid();
-    std::ofstream outfile(pidfile);
-    if (outfile.is_open()) {
-        outfile << current_pid << std::endl;
-        outfile.close();
-        LOGI("Process PID %d written to %s", current_pid, pidfile);
-    } else {
-        LOGE("Failed to write PID to file");
-        if (fd != -1) close(fd);
+    bool written = write_pid_file();
+    if (fd != -1) close(fd);
+    return written;
+}
+
+// 打开wake_lock/wake_unlock接口，保持打开以便按需快速加解锁
+bool open_wakelock_interface() {
+    g_wakelock_fd = open("/sys/power/wake_lock", O_WRONLY | O_CLOEXEC);
+    g_wakeunlock_fd = open("/sys/power/wake_unlock", O_WRONLY | O_CLOEXEC);
+    
+    if (g_wakelock_fd == -1 || g_wakeunlock_fd == -1) {
+        LOGE("Failed to open wake_lock interface: %s", strerror(errno));
         return false;
     }
     
-    if (fd != -1) close(fd);
+    LOGI("Wake lock interface opened, locks will be held only while needed");
     return true;
 }
 
-// 获取WakeLock
-bool acquire_wakelock() {
-    const char* wakelock_path = "/sys/power/wake_lock";
-    g_wakelock_fd = open(wakelock_path, O_WRONLY);
+// 获取具名唤醒锁（引用计数，首次持有时写入wake_lock）
+void wake_source_acquire(WakeSource& ws) {
+    std::lock_guard<std::mutex> lock(g_wake_mutex);
+    if (ws.refcount++ > 0) return;
+    ws.acquire_count++;
+    ws.acquired_at_ns = monotonic_ns();
+    if (g_wakelock_fd != -1 && !g_wake_detached && write(g_wakelock_fd, ws.name, strlen(ws.name)) == -1) {
+        LOGE("Failed to acquire wake lock %s: %s", ws.name, strerror(errno));
+    }
+}
+
+// 释放具名唤醒锁（最后一个持有者释放时写入wake_unlock并累计持有时间）
+void wake_source_release(WakeSource& ws) {
+    std::lock_guard<std::mutex> lock(g_wake_mutex);
+    if (ws.refcount == 0 || --ws.refcount > 0) return;
+    ws.held_ns_total += monotonic_ns() - ws.acquired_at_ns;
+    if (g_wakeunlock_fd != -1 && !g_wake_detached && write(g_wakeunlock_fd, ws.name, strlen(ws.name)) == -1) {
+        LOGE("Failed to release wake lock %s: %s", ws.name, strerror(errno));
+    }
+}
+
+// 释放所有唤醒锁并关闭接口
+void release_wakelock() {
+    for (WakeSource* ws : { &g_gesture_wake, &g_action_wake }) {
+        std::lock_guard<std::mutex> lock(g_wake_mutex);
+        if (ws->refcount > 0 && g_wakeunlock_fd != -1) {
+            ws->held_ns_total += monotonic_ns() - ws->acquired_at_ns;
+            ws->refcount = 0;
+            if (!g_wake_detached) write(g_wakeunlock_fd, ws->name, strlen(ws->name));
+        }
+    }
+    if (g_wakelock_fd != -1) { close(g_wakelock_fd); g_wakelock_fd = -1; }
+    if (g_wakeunlock_fd != -1) { close(g_wakeunlock_fd); g_wakeunlock_fd = -1; }
+    LOGI("Wake locks released");
+}
+
+// 为匿名映射命名，使其在/proc/<pid>/smaps中显示为[anon:<name>]，便于按子系统统计内存
+// 内核未开启CONFIG_ANON_VMA_NAME时调用失败，不影响功能
+#ifndef PR_SET_VMA
+#define PR_SET_VMA 0x53564d41
+#define PR_SET_VMA_ANON_NAME 0
+#endif
+#define ARENA_VMA_NAME "kctrl:config"
+static void name_anon_mapping(void* addr, size_t size, const char* name) {
+    prctl(PR_SET_VMA, PR_SET_VMA_ANON_NAME, reinterpret_cast<unsigned long>(addr), size,
+          reinterpret_cast<unsigned long>(name));
+}
+
+// 配置数据的线性分配器：以mmap块为单位分配，随配置整体释放
+struct Arena {
+    struct Block {
+        Block* next;
+        size_t size;
+        size_t used;
+    };
+    Block* head = nullptr;
+    size_t reserved = 0;  // 已映射的总字节数
     
-    if (g_wakelock_fd == -1) {
-        LOGE("Failed to open wake_lock: %s", strerror(errno));
-        return false;
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() { release(); }
+    
+    void* alloc(size_t size, size_t align = alignof(std::max_align_t)) {
+        if (head) {
+            size_t offset = (head->used + align - 1) & ~(align - 1);
+            if (offset + size <= head->size) {
+                head->used = offset + size;
+                return reinterpret_cast<char*>(head) + offset;
+            }
+        }
+        // 当前块不足，映射新块（至少64KB）
+        size_t header = (sizeof(Block) + align - 1) & ~(align - 1);
+        size_t block_size = header + size;
+        if (block_size < 64 * 1024) block_size = 64 * 1024;
+        block_size = (block_size + 4095) & ~static_cast<size_t>(4095);
+        void* mem = mmap(nullptr, block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return nullptr;
+        name_anon_mapping(mem, block_size, ARENA_VMA_NAME);
+        Block* block = static_cast<Block*>(mem);
+        block->next = head;
+        block->size = block_size;
+        block->used = header + size;
+        head = block;
+        reserved += block_size;
+        return reinterpret_cast<char*>(block) + header;
     }
     
-    const char* lock_name = "kctrl_wakelock";
-    if (write(g_wakelock_fd, lock_name, strlen(lock_name)) == -1) {
-        LOGE("Failed to acquire wake lock: %s", strerror(errno));
-        close(g_wakelock_fd);
-        g_wakelock_fd = -1;
-        return false;
+    template <typename T>
+    T* alloc_array(size_t count) {
+        return static_cast<T*>(alloc(sizeof(T) * (count ? count : 1), alignof(T)));
     }
     
-    LOGI("Wake lock acquired successfully");
-    return true;
+    std::string_view copy(std::string_view s) {
+        if (s.empty()) return std::string_view();
+        char* mem = static_cast<char*>(alloc(s.size() + 1, 1));
+        if (!mem) return std::string_view();
+        memcpy(mem, s.data(), s.size());
+        mem[s.size()] = '\0';  // 保留结尾NUL，便于直接传给C接口
+        return std::string_view(mem, s.size());
+    }
+    
+    void release() {
+        while (head) {
+            Block* next = head->next;
+            munmap(head, head->size);
+            head = next;
+        }
+        reserved = 0;
+    }
+};
+
+// 配置项（键值均指向arena中以NUL结尾的字符串）
+struct ConfigEntry {
+    std::string_view key;
+    std::string_view value;
+};
+
+// 绑定的守卫条件：<状态名>=<值> 或 <状态名>!=<值>
+struct BindingGuard {
+    uint16_t watch;           // 状态监视的下标（与配置中watch_*的排序一致）
+    bool negate;
+    std::string_view value;
+};
+
+// 动作入队策略：script_<按键码>_<手势>=<脚本> [选项...]，未写选项时使用action_policy
+#define POLICY_COALESCE  0x01  // 队列中已有同一绑定的请求时合并
+#define POLICY_SERIALIZE 0x02  // 同一按键的动作依次执行，不并发
+#define POLICY_DROP_OLDEST 0x04  // 队列满时挤掉最早的请求（默认丢弃新请求）
+struct ActionPolicy {
+    uint8_t flags;
+    uint32_t rate_count;             // 令牌桶：每rate_period_ms内最多rate_count次，0为不限
+    uint32_t rate_period_ms;
+    mutable uint64_t rate_tat_ns;    // GCRA理论到达时间，仅事件循环线程访问
+};
+
+// 动作未入队的原因（FR_DROP的value）
+enum DropReason : int32_t {
+    DROP_QUEUE_FULL = 0,    // 队列满，丢弃新请求
+    DROP_EVICTED = 1,       // 队列满，被新请求挤掉
+    DROP_COALESCED = 2,     // 与队列中同一绑定的请求合并
+    DROP_RATE_LIMITED = 3,  // 超出令牌桶速率
+};
+
+// 一个手势绑定的动作
+// 同一按键与手势可以有多条带不同守卫的绑定，按配置顺序串成链，分发时取第一条守卫全部成立的
+#define PROFILE_ACTION_PREFIX "@profile:"
+struct ScriptAction {
+    std::string_view script;  // 脚本名（或@profile:<名称>）
+    std::string_view device;  // 非空时只分发该设备上的手势（script_<按键>_<手势>@<设备>）
+    int script_fd;            // 预加载的memfd，-1表示回退到磁盘路径
+    int profile;              // >=0时为切换到该配置方案，不启动脚本
+    const BindingGuard* guards;
+    size_t guard_count;
+    const ScriptAction* next;
+    ActionPolicy policy;
+};
+
+// 每个按键的绑定，按手势编号直接索引
+// 按键级时间参数与绑定放在同一表项中，释放时随绑定一起取出，不需要额外查找
+#define GESTURE_TYPE_COUNT 4
+struct KeyBindings {
+    const ScriptAction* actions[GESTURE_TYPE_COUNT];
+    GestureTiming timing;  // 未设置的字段为TIMING_UNSET
+};
+
+// 设备级时间参数：<参数>@<设备>，设备的写法与device配置项相同
+struct DeviceTiming {
+    std::string_view device;
+    GestureTiming timing;  // 未设置的字段为TIMING_UNSET
+};
+
+// 一个配置方案的分发表：按键码 -> 紧凑下标 -> 按手势索引的动作链
+// 方案中未绑定的按键与手势沿用default方案的绑定
+#define NO_BINDING 0xFFFF
+#define DEFAULT_PROFILE 0
+struct ProfileTable {
+    std::string_view name;
+    uint16_t key_index[KEY_CNT];
+    const KeyBindings* bindings;
+    size_t binding_count;                   // 有绑定或按键级时间参数的按键数
+};
+
+// 编译后的配置：排序的设置项、各配置方案的绑定表与预加载脚本，数据全部位于arena中
+struct CompiledConfig {
+    Arena arena;
+    const ConfigEntry* settings = nullptr;  // 非绑定配置项，按key排序
+    size_t settings_count = 0;
+    const ProfileTable* profiles = nullptr; // profiles[DEFAULT_PROFILE]为default方案
+    size_t profile_count = 0;
+    size_t action_count = 0;                // 绑定条目数
+    GestureTiming timing = { 200, 1000, 300, 0 };  // 全局时间参数
+    const DeviceTiming* device_timings = nullptr;
+    size_t device_timing_count = 0;
+    int* script_fds = nullptr;              // 本配置持有的memfd
+    size_t script_fd_count = 0;
+};
+
+// 当前生效的配置与配置方案（仅事件循环线程访问）
+// 切换方案只替换g_profile指针，不重新解析，也不影响进行中的手势状态
+static CompiledConfig* g_cfg = nullptr;
+static const ProfileTable* g_profile = nullptr;
+static std::string g_profile_name = "default";  // 重载配置后按名称重新选择
+static uint64_t g_cfg_generation = 0;           // 每次加载配置递增，设备据此刷新缓存的时间参数
+static uint64_t g_profile_switches = 0;
+
+static void destroy_config(CompiledConfig* cfg) {
+    if (!cfg) return;
+    for (size_t i = 0; i < cfg->script_fd_count; i++) close(cfg->script_fds[i]);
+    delete cfg;
 }
 
-// 释放WakeLock
-void release_wakelock() {
-    if (g_wakelock_fd != -1) {
-        const char* wakeunlock_path = "/sys/power/wake_unlock";
-        int fd = open(wakeunlock_path, O_WRONLY);
-        if (fd != -1) {
-            const char* lock_name = "kctrl_wakelock";
-            write(fd, lock_name, strlen(lock_name));
-            close(fd);
+// 查找设置项，不存在时返回空
+static std::string_view config_get(const CompiledConfig* cfg, std::string_view key) {
+    if (!cfg) return std::string_view();
+    const ConfigEntry* begin = cfg->settings;
+    const ConfigEntry* end = cfg->settings + cfg->settings_count;
+    const ConfigEntry* it = std::lower_bound(begin, end, key,
+        [](const ConfigEntry& e, std::string_view k) { return e.key < k; });
+    return (it != end && it->key == key) ? it->value : std::string_view();
+}
+
+// 查找键名以prefix开头的设置项（已排序，为连续的一段）
+static std::pair<const ConfigEntry*, const ConfigEntry*> config_prefix_range(const CompiledConfig* cfg,
+                                                                             std::string_view prefix) {
+    const ConfigEntry* end = cfg->settings + cfg->settings_count;
+    const ConfigEntry* first = std::lower_bound(cfg->settings, end, prefix,
+        [](const ConfigEntry& e, std::string_view k) { return e.key < k; });
+    const ConfigEntry* last = first;
+    while (last != end && last->key.compare(0, prefix.size(), prefix) == 0) ++last;
+    return { first, last };
+}
+
+static bool config_has(const CompiledConfig* cfg, std::string_view key) {
+    return !config_get(cfg, key).empty();
+}
+
+static std::string_view config_get(std::string_view key) { return config_get(g_cfg, key); }
+
+// 切换到指定名称的配置方案，只替换分发表指针；名称为空时回到default
+static bool switch_profile(std::string_view name) {
+    if (!g_cfg) return false;
+    if (name.empty()) name = "default";
+    for (size_t i = 0; i < g_cfg->profile_count; i++) {
+        const ProfileTable* table = &g_cfg->profiles[i];
+        if (table->name != name) continue;
+        if (table != g_profile) {
+            int from = g_profile ? static_cast<int>(g_profile - g_cfg->profiles) : -1;
+            g_profile = table;
+            g_profile_name.assign(name.data(), name.size());
+            g_profile_switches++;
+            flight_record(FR_PROFILE, 0, static_cast<int32_t>(i), from);
+            LOGI("Switched to profile %s", table->name.data());
         }
-        close(g_wakelock_fd);
-        g_wakelock_fd = -1;
-        LOGI("Wake lock released");
+        return true;
     }
+    LOGW("Unknown profile: %.*s", (int)name.size(), name.data());
+    return false;
 }
 
-// 读取配置文件 - 深度内存优化版本
-bool load_config(const char* config_file) {
-    // 清空现有配置，确保重新加载时不会累积旧配置
-    g_config.clear();
+// 将字符串视图解析为整数，失败时返回默认值
+static int sv_to_int(std::string_view s, int fallback = 0) {
+    int value = fallback;
+    auto result = std::from_chars(s.data(), s.data() + s.size(), value);
+    return result.ec == std::errc() ? value : fallback;
+}
+
+// 去除首尾空白
+static std::string_view sv_trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\r')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+// 手势后缀 -> 手势编号
+static int gesture_from_suffix(std::string_view suffix) {
+    if (suffix == "click") return GESTURE_CLICK;
+    if (suffix == "double_click") return GESTURE_DOUBLE_CLICK;
+    if (suffix == "short_press") return GESTURE_SHORT_PRESS;
+    if (suffix == "long_press") return GESTURE_LONG_PRESS;
+    return -1;
+}
+
+// 按键码或按键名称（VOLUMEUP、KEY_POWER、BTN_LEFT），在加载时解析为数值
+static int parse_keycode(std::string_view text) {
+    if (!text.empty() && text[0] >= '0' && text[0] <= '9') return sv_to_int(text, -1);
+    return key_code(text);
+}
+
+// 解析绑定键 script_<按键码|按键名称>_<手势>
+// 按键名称本身可能含下划线，因此从末尾匹配手势名
+static bool parse_binding_key(std::string_view key, int& keycode, int& gesture) {
+    key.remove_prefix(7);  // "script_"
+    static const char* const suffixes[] = { "_double_click", "_short_press", "_long_press", "_click" };
+    for (const char* suffix : suffixes) {
+        std::string_view tail(suffix);
+        if (key.size() <= tail.size() || key.substr(key.size() - tail.size()) != tail) continue;
+        keycode = parse_keycode(key.substr(0, key.size() - tail.size()));
+        gesture = gesture_from_suffix(tail.substr(1));
+        return keycode >= 0 && keycode < KEY_CNT;
+    }
+    return false;
+}
+
+// 时间参数的设置项名，按GestureTiming字段顺序
+static const char* const g_timing_keys[] = { "click_threshold", "long_press_threshold", "double_click_interval",
+                                              "debounce_interval" };
+#define TIMING_FIELD_COUNT (sizeof(g_timing_keys) / sizeof(g_timing_keys[0]))
+
+static uint16_t& timing_field(GestureTiming& timing, int field) {
+    return field == 0 ? timing.click_ms : field == 1 ? timing.long_ms : field == 2 ? timing.double_ms :
+           timing.debounce_ms;
+}
+
+// 把按键级/设备级参数中已设置的字段覆盖到base上
+static void timing_overlay(GestureTiming& base, const GestureTiming& over) {
+    if (over.click_ms != TIMING_UNSET) base.click_ms = over.click_ms;
+    if (over.long_ms != TIMING_UNSET) base.long_ms = over.long_ms;
+    if (over.double_ms != TIMING_UNSET) base.double_ms = over.double_ms;
+    if (over.debounce_ms != TIMING_UNSET) base.debounce_ms = over.debounce_ms;
+}
+
+// 解析动作策略选项（空白分隔）：coalesce serialize drop=oldest|newest rate=<次数>[/<秒>]
+static bool parse_action_policy(std::string_view options, ActionPolicy& policy) {
+    bool ok = true;
+    while (!options.empty()) {
+        size_t sep = options.find_first_of(" \t");
+        std::string_view option = options.substr(0, sep);
+        options = sv_trim(options.substr(sep == std::string_view::npos ? options.size() : sep));
+        if (option.empty()) continue;
+        if (option == "coalesce") {
+            policy.flags |= POLICY_COALESCE;
+        } else if (option == "serialize") {
+            policy.flags |= POLICY_SERIALIZE;
+        } else if (option == "drop=oldest") {
+            policy.flags |= POLICY_DROP_OLDEST;
+        } else if (option == "drop=newest") {
+            policy.flags &= ~POLICY_DROP_OLDEST;
+        } else if (option.compare(0, 5, "rate=") == 0) {
+            std::string_view rate = option.substr(5);
+            size_t slash = rate.find('/');
+            int count = sv_to_int(rate.substr(0, slash), 0);
+            int seconds = (slash == std::string_view::npos) ? 1 : sv_to_int(rate.substr(slash + 1), 0);
+            if (count <= 0 || seconds <= 0) {
+                ok = false;
+                continue;
+            }
+            policy.rate_count = static_cast<uint32_t>(count);
+            policy.rate_period_ms = static_cast<uint32_t>(seconds) * 1000;
+        } else {
+            LOGW("Unknown action option: %.*s", (int)option.size(), option.data());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// 将单个脚本读入密封的memfd
+static int load_script_memfd(std::string_view script_name) {
+    char path[320];
+    snprintf(path, sizeof(path), "%s/%s/%.*s", g_data_dir.c_str(), SCRIPTS_DIR, (int)script_name.size(), script_name.data());
     
-    // 使用C风格文件操作减少内存开销
-    FILE* file = fopen(config_file, "r");
-    if (!file) {
-        LOGE("Failed to open config file: %s", config_file);
-        return false;
+    int src = open(path, O_RDONLY | O_CLOEXEC);
+    if (src == -1) {
+        LOGW("Failed to open script %s: %s", path, strerror(errno));
+        return -1;
     }
     
-    // 使用固定大小缓冲区避免动态分配
-    static char line_buffer[256];
-    static char key_buffer[64];
-    static char value_buffer[192];
+    // script_name来自arena，以NUL结尾
+    int mfd = memfd_create(script_name.data(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (mfd == -1) {
+        LOGE("memfd_create failed for %s: %s", script_name.data(), strerror(errno));
+        close(src);
+        return -1;
+    }
     
-    while (fgets(line_buffer, sizeof(line_buffer), file)) {
-        // 跳过空行和注释
-        if (line_buffer[0] == '\n' || line_buffer[0] == '#') continue;
-        
-        // 查找等号分隔符
-        char* eq_pos = strchr(line_buffer, '=');
-        if (!eq_pos) continue;
+    char buf[4096];
+    ssize_t n;
+    bool ok = true;
+    while ((n = read(src, buf, sizeof(buf))) > 0) {
+        if (write(mfd, buf, n) != n) { ok = false; break; }
+    }
+    if (n < 0) ok = false;
+    close(src);
+    
+    // 封印后内容不可再修改，执行期间也不会被截断
+    if (!ok || fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        LOGE("Failed to preload script %s: %s", script_name.data(), strerror(errno));
+        close(mfd);
+        return -1;
+    }
+    return mfd;
+}
+
+// 把配置文本编译为CompiledConfig
+// 解析阶段只在原文上切分string_view，不限制行长度；支持行内注释（空白后的'#'）
+// 最终保留的键值一次性复制进arena，这样原文（mmap）可以立即释放，文件被截断也不会影响已编译的配置
+// preload为true时把绑定的脚本预加载进memfd
+static CompiledConfig* compile_config(const char* data, size_t len, bool preload) {
+    struct ParsedBinding {
+        uint16_t profile;
+        uint16_t keycode;
+        uint8_t gesture;
+        std::string_view script;
+        std::string_view options; // 脚本名之后的策略选项
+        std::string_view guards;  // 方括号内的守卫条件原文
+        std::string_view device;  // @之后的设备限定
+    };
+    std::vector<ConfigEntry> settings;
+    std::vector<ParsedBinding> parsed;
+    std::vector<std::string_view> profile_names(1, "default");
+    size_t profile = DEFAULT_PROFILE;
+    
+    std::string_view text(data, len);
+    while (!text.empty()) {
+        size_t nl = text.find('\n');
+        std::string_view line = text.substr(0, nl);
+        text.remove_prefix(nl == std::string_view::npos ? text.size() : nl + 1);
         
-        // 分离键值对
-        size_t key_len = eq_pos - line_buffer;
-        if (key_len >= sizeof(key_buffer)) continue;
+        // 去掉行内注释：行首的'#'或空白之后的'#'
+        for (size_t i = 0; i < line.size(); i++) {
+            if (line[i] == '#' && (i == 0 || line[i - 1] == ' ' || line[i - 1] == '\t')) {
+                line = line.substr(0, i);
+                break;
+            }
+        }
         
-        strncpy(key_buffer, line_buffer, key_len);
-        key_buffer[key_len] = '\0';
+        // 配置方案段：[名称]，之后的绑定属于该方案，直到下一个段
+        std::string_view header = sv_trim(line);
+        if (header.size() > 2 && header.front() == '[' && header.back() == ']' &&
+            header.find('=') == std::string_view::npos) {
+            header = sv_trim(header.substr(1, header.size() - 2));
+            auto found = std::find(profile_names.begin(), profile_names.end(), header);
+            profile = found - profile_names.begin();
+            if (found == profile_names.end()) profile_names.push_back(header);
+            continue;
+        }
         
-        // 移除值末尾的换行符
-        char* value_start = eq_pos + 1;
-        size_t value_len = strlen(value_start);
-        if (value_len > 0 && value_start[value_len - 1] == '\n') {
-            value_start[value_len - 1] = '\0';
+        size_t eq = line.find('=');
+        if (eq == std::string_view::npos) continue;
+        // 守卫条件中的'='属于键名：script_115_click[screen=off]=...
+        size_t bracket = line.find('[');
+        if (bracket < eq) {
+            size_t close = line.find(']', bracket);
+            eq = (close == std::string_view::npos) ? close : line.find('=', close);
+            if (eq == std::string_view::npos) continue;
         }
+        std::string_view key = sv_trim(line.substr(0, eq));
+        std::string_view value = sv_trim(line.substr(eq + 1));
+        if (key.empty()) continue;
         
-        strncpy(value_buffer, value_start, sizeof(value_buffer) - 1);
-        value_buffer[sizeof(value_buffer) - 1] = '\0';
+        if (key.compare(0, 7, "script_") == 0) {
+            int keycode, gesture;
+            std::string_view guards, trailing;
+            size_t open = key.find('[');
+            if (open != std::string_view::npos) {
+                size_t close = key.find(']', open);
+                guards = key.substr(open + 1, close == std::string_view::npos ? close : close - open - 1);
+                if (close != std::string_view::npos) trailing = sv_trim(key.substr(close + 1));
+                key = sv_trim(key.substr(0, open));
+            }
+            // 设备限定：script_<按键>_<手势>@<设备>，也可写在守卫条件之后
+            std::string_view device;
+            size_t at = key.find('@');
+            if (at != std::string_view::npos) {
+                device = sv_trim(key.substr(at + 1));
+                key = sv_trim(key.substr(0, at));
+            }
+            bool trailing_ok = trailing.empty();
+            if (!trailing.empty() && trailing[0] == '@' && at == std::string_view::npos) {
+                at = 0;
+                device = sv_trim(trailing.substr(1));
+                trailing_ok = true;
+            }
+            // 脚本名到首个空白为止，之后为策略选项
+            size_t space = value.find_first_of(" \t");
+            std::string_view options = (space == std::string_view::npos) ? std::string_view() :
+                                       sv_trim(value.substr(space));
+            value = value.substr(0, space);
+            if (parse_binding_key(key, keycode, gesture) && !value.empty() && trailing_ok &&
+                (at == std::string_view::npos || !device.empty())) {
+                parsed.push_back({ static_cast<uint16_t>(profile), static_cast<uint16_t>(keycode),
+                                   static_cast<uint8_t>(gesture), value, options, guards, device });
+            } else {
+                LOGW("Invalid binding: %.*s", (int)key.size(), key.data());
+            }
+        } else if (profile == DEFAULT_PROFILE) {
+            settings.push_back({ key, value });
+        } else {
+            LOGW("Only bindings are allowed in profile [%.*s], ignored: %.*s",
+                 (int)profile_names[profile].size(), profile_names[profile].data(), (int)key.size(), key.data());
+        }
+    }
+    
+    CompiledConfig* cfg = new CompiledConfig();
+    
+    // 设置项排序后二分查找；重复的键保留第一次出现的值
+    std::stable_sort(settings.begin(), settings.end(),
+                     [](const ConfigEntry& a, const ConfigEntry& b) { return a.key < b.key; });
+    ConfigEntry* out_settings = cfg->arena.alloc_array<ConfigEntry>(settings.size());
+    size_t settings_count = 0;
+    for (size_t i = 0; i < settings.size(); i++) {
+        if (settings_count > 0 && out_settings[settings_count - 1].key == settings[i].key) continue;
+        out_settings[settings_count].key = cfg->arena.copy(settings[i].key);
+        out_settings[settings_count].value = cfg->arena.copy(settings[i].value);
+        settings_count++;
+    }
+    cfg->settings = out_settings;
+    cfg->settings_count = settings_count;
+    
+    // 时间参数：全局<参数>、按键级<参数>_<按键>、设备级<参数>@<设备>，均为0-65534毫秒
+    // 按键级参数写入各方案分发表的按键表项，设备级参数由设备在配置变化后解析一次
+    std::vector<std::pair<uint16_t, GestureTiming>> key_timings;
+    std::vector<DeviceTiming> device_timings;
+    const GestureTiming unset = { TIMING_UNSET, TIMING_UNSET, TIMING_UNSET, TIMING_UNSET };
+    for (int f = 0; f < static_cast<int>(TIMING_FIELD_COUNT); f++) {
+        std::string_view param = g_timing_keys[f];
+        auto range = config_prefix_range(cfg, param);
+        for (const ConfigEntry* e = range.first; e != range.second; ++e) {
+            std::string_view rest = e->key.substr(param.size());
+            if (!rest.empty() && rest[0] != '_' && rest[0] != '@') continue;
+            int ms = sv_to_int(e->value, -1);
+            int keycode = (!rest.empty() && rest[0] == '_') ? parse_keycode(rest.substr(1)) : 0;
+            if (ms < 0 || ms >= TIMING_UNSET || keycode < 0 || keycode >= KEY_CNT || rest == "@") {
+                LOGW("Invalid timing entry: %s=%s", e->key.data(), e->value.data());
+                continue;
+            }
+            if (rest.empty()) {
+                timing_field(cfg->timing, f) = static_cast<uint16_t>(ms);
+            } else if (rest[0] == '_') {
+                auto it = std::find_if(key_timings.begin(), key_timings.end(),
+                                       [keycode](const auto& k) { return k.first == keycode; });
+                if (it == key_timings.end()) it = key_timings.insert(it, { static_cast<uint16_t>(keycode), unset });
+                timing_field(it->second, f) = static_cast<uint16_t>(ms);
+            } else {
+                std::string_view device = rest.substr(1);
+                auto it = std::find_if(device_timings.begin(), device_timings.end(),
+                                       [device](const DeviceTiming& d) { return d.device == device; });
+                if (it == device_timings.end()) it = device_timings.insert(it, { device, unset });
+                timing_field(it->timing, f) = static_cast<uint16_t>(ms);
+            }
+        }
+    }
+    DeviceTiming* out_device_timings = cfg->arena.alloc_array<DeviceTiming>(device_timings.size());
+    std::copy(device_timings.begin(), device_timings.end(), out_device_timings);
+    cfg->device_timings = out_device_timings;
+    cfg->device_timing_count = device_timings.size();
+    
+    // 守卫中的状态名按watch_*设置项的排序解析为下标
+    auto watches = config_prefix_range(cfg, "watch_");
+    
+    // 未写选项的绑定使用action_policy
+    ActionPolicy default_policy = { 0, 0, 0, 0 };
+    if (!parse_action_policy(config_get(cfg, "action_policy"), default_policy)) {
+        LOGW("Invalid action_policy: %s", config_get(cfg, "action_policy").data());
+    }
+    
+    // 先把每条绑定编译为动作，按(方案, 按键, 手势)串成链
+    // 限定设备的绑定排在链的前面，比不限定设备的绑定优先；两类内部保持配置顺序
+    std::stable_partition(parsed.begin(), parsed.end(), [](const ParsedBinding& b) { return !b.device.empty(); });
+    struct Chain {
+        ScriptAction* head;
+        ScriptAction* tail;
+    };
+    auto chain_key = [](size_t p, int keycode, int gesture) {
+        return static_cast<uint32_t>((p * KEY_CNT + keycode) * GESTURE_TYPE_COUNT + gesture);
+    };
+    std::unordered_map<uint32_t, Chain> chains;
+    std::unordered_map<std::string_view, int> script_fds;  // 同名脚本只预加载一次
+    std::vector<int> owned_fds;
+    std::vector<BindingGuard> guards;
+    for (const auto& b : parsed) {
+        // 解析守卫条件，逗号分隔，全部成立才分发
+        guards.clear();
+        bool guards_ok = true;
+        std::string_view rest = b.guards;
+        while (guards_ok && !rest.empty()) {
+            size_t comma = rest.find(',');
+            std::string_view cond = sv_trim(rest.substr(0, comma));
+            rest.remove_prefix(comma == std::string_view::npos ? rest.size() : comma + 1);
+            size_t op = cond.find('=');
+            if (op == std::string_view::npos || op == 0) {
+                guards_ok = false;
+                break;
+            }
+            bool negate = cond[op - 1] == '!';
+            std::string_view name = sv_trim(cond.substr(0, negate ? op - 1 : op));
+            const ConfigEntry* watch = watches.first;
+            while (watch != watches.second && watch->key.substr(6) != name) ++watch;
+            if (watch == watches.second) {
+                LOGW("Unknown state in guard: %.*s (declare watch_%.*s=<path>)",
+                     (int)name.size(), name.data(), (int)name.size(), name.data());
+                guards_ok = false;
+                break;
+            }
+            guards.push_back({ static_cast<uint16_t>(watch - watches.first), negate,
+                               cfg->arena.copy(sv_trim(cond.substr(op + 1))) });
+        }
+        if (!guards_ok) {
+            LOGW("Invalid guard for binding script_%u_%s[%.*s], ignored", b.keycode, gesture_name(b.gesture),
+                 (int)b.guards.size(), b.guards.data());
+            continue;
+        }
         
-        // 存储配置
-        g_config.emplace(key_buffer, value_buffer);
+        // @profile:<名称> 切换配置方案，不启动脚本
+        int target = -1;
+        if (b.script.compare(0, strlen(PROFILE_ACTION_PREFIX), PROFILE_ACTION_PREFIX) == 0) {
+            std::string_view name = b.script.substr(strlen(PROFILE_ACTION_PREFIX));
+            auto found = std::find(profile_names.begin(), profile_names.end(), name);
+            if (found == profile_names.end()) {
+                LOGW("Unknown profile in binding: %.*s, ignored", (int)b.script.size(), b.script.data());
+                continue;
+            }
+            target = static_cast<int>(found - profile_names.begin());
+        }
         
-        // 只对非脚本配置输出日志
-        if (strncmp(key_buffer, "script_", 7) != 0) {
-            LOGI("Config: %s = %s", key_buffer, value_buffer);
+        ActionPolicy policy = default_policy;
+        if (!b.options.empty()) {
+            policy = ActionPolicy{ 0, 0, 0, 0 };
+            if (!parse_action_policy(b.options, policy)) {
+                LOGW("Invalid options for binding script_%u_%s: %.*s", b.keycode, gesture_name(b.gesture),
+                     (int)b.options.size(), b.options.data());
+            }
         }
         
-        // 解析时间配置参数
-        if (strcmp(key_buffer, "click_threshold") == 0) {
-            g_click_threshold = atoi(value_buffer);
-        } else if (strcmp(key_buffer, "short_press_threshold") == 0) {
-            g_short_press_threshold = atoi(value_buffer);
-        } else if (strcmp(key_buffer, "long_press_threshold") == 0) {
-            g_long_press_threshold = atoi(value_buffer);
-        } else if (strcmp(key_buffer, "double_click_interval") == 0) {
-            g_double_click_interval = atoi(value_buffer);
-        } else if (strcmp(key_buffer, "enable_log") == 0) {
-            g_enable_log = (atoi(value_buffer) != 0);
+        ScriptAction* action = cfg->arena.alloc_array<ScriptAction>(1);
+        *action = ScriptAction{ cfg->arena.copy(b.script), cfg->arena.copy(b.device), -1, target,
+                                nullptr, 0, nullptr, policy };
+        if (!guards.empty()) {
+            BindingGuard* out_guards = cfg->arena.alloc_array<BindingGuard>(guards.size());
+            std::copy(guards.begin(), guards.end(), out_guards);
+            action->guards = out_guards;
+            action->guard_count = guards.size();
+        }
+        // 同一链中按配置顺序追加
+        auto inserted = chains.emplace(chain_key(b.profile, b.keycode, b.gesture), Chain{ action, action });
+        if (!inserted.second) {
+            inserted.first->second.tail->next = action;
+            inserted.first->second.tail = action;
         }
+        cfg->action_count++;
+        if (!preload || target >= 0) continue;
+        auto it = script_fds.find(action->script);
+        if (it == script_fds.end()) {
+            int mfd = load_script_memfd(action->script);
+            if (mfd != -1) owned_fds.push_back(mfd);
+            it = script_fds.emplace(action->script, mfd).first;
+        }
+        action->script_fd = it->second;
     }
     
-    fclose(file);
-    LOGI("Config loaded - Click: %dms, Short: %dms, Long: %dms, Double: %dms, Log: %s", 
-         g_click_threshold, g_short_press_threshold, g_long_press_threshold, g_double_click_interval,
-         g_enable_log ? "enabled" : "disabled");
-    return true;
-}
-
-// 基于通配符的简单匹配（仅支持'*'）
-static bool wildcard_match(const std::string& text, const std::string& pattern) {
-    size_t t = 0, p = 0, star = std::string::npos, match = 0;
-    while (t < text.size()) {
-        if (p < pattern.size() && (pattern[p] == text[t])) {
-            ++t; ++p; // 逐字符匹配
-        } else if (p < pattern.size() && pattern[p] == '*') {
-            star = p++;
-            match = t;
-        } else if (star != std::string::npos) {
-            p = star + 1;
-            t = ++match; // 尝试扩展'*'匹配
-        } else {
-            return false;
+    // 为每个方案生成分发表：方案自身的链优先，其余沿用default方案
+    ProfileTable* profiles = cfg->arena.alloc_array<ProfileTable>(profile_names.size());
+    std::vector<uint16_t> keycodes;
+    for (size_t p = 0; p < profile_names.size(); p++) {
+        ProfileTable& table = profiles[p];
+        table.name = cfg->arena.copy(profile_names[p]);
+        for (int i = 0; i < KEY_CNT; i++) table.key_index[i] = NO_BINDING;
+        keycodes.clear();
+        for (const auto& b : parsed) {
+            if ((b.profile == p || b.profile == DEFAULT_PROFILE) && table.key_index[b.keycode] == NO_BINDING) {
+                table.key_index[b.keycode] = static_cast<uint16_t>(keycodes.size());
+                keycodes.push_back(b.keycode);
+            }
+        }
+        // 只设置了时间参数的按键也占一个表项（没有动作）
+        for (const auto& k : key_timings) {
+            if (table.key_index[k.first] != NO_BINDING) continue;
+            table.key_index[k.first] = static_cast<uint16_t>(keycodes.size());
+            keycodes.push_back(k.first);
+        }
+        KeyBindings* bindings = cfg->arena.alloc_array<KeyBindings>(keycodes.size());
+        for (size_t i = 0; i < keycodes.size(); i++) {
+            for (int g = 0; g < GESTURE_TYPE_COUNT; g++) {
+                auto it = chains.find(chain_key(p, keycodes[i], g));
+                if (it == chains.end()) it = chains.find(chain_key(DEFAULT_PROFILE, keycodes[i], g));
+                bindings[i].actions[g] = (it == chains.end()) ? nullptr : it->second.head;
+            }
+            bindings[i].timing = unset;
+            for (const auto& k : key_timings) {
+                if (k.first == keycodes[i]) bindings[i].timing = k.second;
+            }
         }
+        table.bindings = bindings;
+        table.binding_count = keycodes.size();
     }
-    while (p < pattern.size() && pattern[p] == '*') ++p;
-    return p == pattern.size();
+    cfg->profiles = profiles;
+    cfg->profile_count = profile_names.size();
+    
+    cfg->script_fds = cfg->arena.alloc_array<int>(owned_fds.size());
+    if (!owned_fds.empty()) memcpy(cfg->script_fds, owned_fds.data(), owned_fds.size() * sizeof(int));
+    cfg->script_fd_count = owned_fds.size();
+    return cfg;
 }
 
-// 获取输入设备名称
-static bool get_input_device_name(const std::string& device_path, std::string& out_name) {
-    int fd = open(device_path.c_str(), O_RDONLY);
-    if (fd < 0) return false;
-    char name[256] = {0};
-    bool ok = ioctl(fd, EVIOCGNAME(sizeof(name)), name) >= 0;
+// mmap配置文件并编译；文件为空时得到空配置
+static CompiledConfig* compile_config_file(const char* config_file, bool preload) {
+    int fd = open(config_file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return nullptr;
+    }
+    
+    size_t len = static_cast<size_t>(st.st_size);
+    const char* data = "";
+    void* map = nullptr;
+    if (len > 0) {
+        map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return nullptr;
+        }
+        data = static_cast<const char*>(map);
+    }
     close(fd);
-    if (ok) out_name.assign(name);
-    return ok;
+    
+    CompiledConfig* cfg = compile_config(data, len, preload);
+    if (map) munmap(map, len);
+    return cfg;
 }
 
-// 从 /dev/input 直接枚举 event 设备并读取名称
-struct InputDevInfo { std::string path; std::string name; };
-static std::vector<InputDevInfo> enumerate_event_devices_via_dev() {
-    std::vector<InputDevInfo> out;
-    DIR* dir = opendir("/dev/input");
+// 守卫条件使用的状态监视：watch_<名称>=<文件路径>
+// 文件内容（首行，去除首尾空白）缓存在内存中，变化时由事件循环更新，分发时直接比较缓存值
+// /sys下的属性通过epoll等待EPOLLPRI（sysfs_notify），其他文件通过inotify监听原地写入
+#define TAG_STATE_BASE 0xFFFF0000u
+#define STATE_VALUE_MAX 64
+struct StateWatch {
+    std::string name;
+    std::string path;
+    int fd = -1;             // sysfs属性保持打开以接收EPOLLPRI
+    int wd = -1;             // 普通文件的inotify监听
+    char value[STATE_VALUE_MAX];
+    size_t value_len = 0;
+    bool selects_profile = false;  // profile_watch指定的状态，值为要切换到的方案名
+};
+
+static std::vector<StateWatch> g_state_watches;
+static int g_epoll_fd = -1;
+static int g_inotify_fd = -1;
+static uint64_t g_guard_blocked = 0;   // 因守卫不成立而未分发的手势数
+static uint64_t g_state_updates = 0;   // 状态缓存更新次数
+
+// 读取状态文件的首行作为缓存值
+static void refresh_state_watch(StateWatch& watch) {
+    char buf[STATE_VALUE_MAX];
+    ssize_t n;
+    if (watch.fd != -1) {
+        // sysfs需要从头重新读取才能清除POLLPRI
+        n = pread(watch.fd, buf, sizeof(buf), 0);
+    } else {
+        int fd = open(watch.path.c_str(), O_RDONLY | O_CLOEXEC);
+        n = (fd == -1) ? -1 : read(fd, buf, sizeof(buf));
+        if (fd != -1) close(fd);
+    }
+    std::string_view value = (n > 0) ? std::string_view(buf, n) : std::string_view();
+    value = sv_trim(value.substr(0, value.find('\n')));
+    memcpy(watch.value, value.data(), value.size());
+    watch.value_len = value.size();
+    g_state_updates++;
+    if (g_enable_log) {
+        LOGI("State %s = %.*s", watch.name.c_str(), (int)watch.value_len, watch.value);
+    }
+    if (watch.selects_profile) switch_profile(std::string_view(watch.value, watch.value_len));
+}
+
+// 按当前配置重建状态监视；事件循环尚未建立时只读取初始值，建立后再次调用完成注册
+static void sync_state_watches() {
+    for (auto& watch : g_state_watches) {
+        if (watch.fd != -1) {
+            if (g_epoll_fd != -1) epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, watch.fd, nullptr);
+            close(watch.fd);
+        }
+        if (watch.wd != -1 && g_inotify_fd != -1) inotify_rm_watch(g_inotify_fd, watch.wd);
+    }
+    g_state_watches.clear();
+    if (!g_cfg) return;
+    
+    auto range = config_prefix_range(g_cfg, "watch_");
+    std::string_view profile_watch = config_get("profile_watch");
+    g_state_watches.resize(range.second - range.first);
+    for (size_t i = 0; i < g_state_watches.size(); i++) {
+        StateWatch& watch = g_state_watches[i];
+        watch.name = std::string(range.first[i].key.substr(6));
+        watch.path = std::string(range.first[i].value);
+        watch.selects_profile = (watch.name == profile_watch);
+        if (watch.path.compare(0, 5, "/sys/") == 0) {
+            watch.fd = open(watch.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (watch.fd == -1) {
+                LOGW("Failed to open state %s: %s", watch.path.c_str(), strerror(errno));
+            } else if (g_epoll_fd != -1) {
+                struct epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLPRI | EPOLLERR;
+                ev.data.u32 = TAG_STATE_BASE + static_cast<uint32_t>(i);
+                if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, watch.fd, &ev) == -1) {
+                    LOGW("Failed to poll state %s: %s", watch.path.c_str(), strerror(errno));
+                }
+            }
+        } else if (g_inotify_fd != -1) {
+            watch.wd = inotify_add_watch(g_inotify_fd, watch.path.c_str(), IN_CLOSE_WRITE | IN_MODIFY);
+            if (watch.wd == -1) LOGW("Failed to watch state %s: %s", watch.path.c_str(), strerror(errno));
+        }
+        refresh_state_watch(watch);
+    }
+    if (!g_state_watches.empty()) LOGI("Watching %zu state file(s)", g_state_watches.size());
+}
+
+// 处理sysfs状态的EPOLLPRI
+static void handle_state_poll(uint32_t index) {
+    if (index < g_state_watches.size()) refresh_state_watch(g_state_watches[index]);
+}
+
+// 处理普通状态文件的inotify事件，返回是否属于状态监视
+static bool handle_state_inotify(int wd) {
+    for (auto& watch : g_state_watches) {
+        if (watch.wd == wd) {
+            refresh_state_watch(watch);
+            return true;
+        }
+    }
+    return false;
+}
+
+// 判断绑定的守卫条件是否全部成立
+static bool guards_pass(const ScriptAction& action) {
+    for (size_t i = 0; i < action.guard_count; i++) {
+        const BindingGuard& guard = action.guards[i];
+        if (guard.watch >= g_state_watches.size()) return false;
+        const StateWatch& watch = g_state_watches[guard.watch];
+        bool equal = std::string_view(watch.value, watch.value_len) == guard.value;
+        if (equal == guard.negate) return false;
+    }
+    return true;
+}
+
+// 读取配置文件 - 深度内存优化版本
+bool load_config(const char* config_file) {
+    TRACE_BEGIN(TRACE_CONFIG);
+    CompiledConfig* cfg = compile_config_file(config_file, true);
+    if (!cfg) {
+        LOGE("Failed to open config file: %s", config_file);
+        flight_record(FR_RELOAD, 0, 0, 0);
+        TRACE_END();
+        return false;
+    }
+    
+    for (size_t i = 0; i < cfg->settings_count; i++) {
+        const ConfigEntry& e = cfg->settings[i];
+        LOGI("Config: %s = %s", e.key.data(), e.value.data());
+    }
+    
+    // 解析时间配置参数
+    // 按键级与设备级参数随分发表与设备生效，这里只是全局默认值
+    g_click_threshold = cfg->timing.click_ms;
+    g_long_press_threshold = cfg->timing.long_ms;
+    g_double_click_interval = cfg->timing.double_ms;
+    g_enable_log = sv_to_int(config_get(cfg, "enable_log"), g_enable_log) != 0;
+    g_remap_enabled = sv_to_int(config_get(cfg, "remap"), g_remap_enabled) != 0;
+    int queue_max = sv_to_int(config_get(cfg, "action_queue_max"), 16);
+    g_action_queue_max.store(static_cast<size_t>(queue_max > 0 ? queue_max : 1), std::memory_order_relaxed);
+    g_action_context_fd.store(sv_to_int(config_get(cfg, "action_context_fd")) != 0, std::memory_order_relaxed);
+    
+    // 在非活动缓冲区中编译重映射表，加载完成后再切换
+    // 设置项已排序，remap_* 是连续的一段
+    int remap_staging = 1 - g_remap_active.load(std::memory_order_relaxed);
+    uint16_t* remap_table = g_remap_tables[remap_staging];
+    for (int i = 0; i < KEY_CNT; i++) remap_table[i] = static_cast<uint16_t>(i);
+    auto remaps = config_prefix_range(cfg, "remap_");
+    for (const ConfigEntry* it = remaps.first; it != remaps.second; ++it) {
+        // remap_<源按键码|名称>=<目标按键码|名称|none>
+        int from = parse_keycode(it->key.substr(6));
+        int to = (it->value == "none") ? REMAP_SUPPRESS : parse_keycode(it->value);
+        if (from > 0 && from < KEY_CNT && to >= 0 && to < KEY_CNT) {
+            remap_table[from] = static_cast<uint16_t>(to);
+        } else {
+            LOGW("Invalid remap entry: %s=%s", it->key.data(), it->value.data());
+        }
+    }
+    g_remap_active.store(remap_staging, std::memory_order_release);
+    
+    // 按名称重新选择当前方案（新配置中已不存在时回到default）
+    CompiledConfig* old = g_cfg;
+    g_cfg = cfg;
+    g_profile = &cfg->profiles[DEFAULT_PROFILE];
+    std::string profile_name = g_profile_name;
+    if (!switch_profile(profile_name)) g_profile_name = "default";
+    destroy_config(old);
+    g_cfg_generation++;
+    sync_state_watches();  // 守卫按watch_*的下标引用状态，须与新配置同步
+    
+    flight_record(FR_RELOAD, 0, 1, 0);
+    TRACE_END();
+    LOGI("Config loaded - %zu binding(s) in %zu profile(s), %zu script(s) preloaded, arena %zuKB, profile %s",
+         cfg->action_count, cfg->profile_count, cfg->script_fd_count, cfg->arena.reserved / 1024,
+         g_profile->name.data());
+    LOGI("Config loaded - Click: %dms, Long: %dms, Double: %dms, %zu device timing override(s), Log: %s", 
+         g_click_threshold, g_long_press_threshold, g_double_click_interval,
+         cfg->device_timing_count, g_enable_log ? "enabled" : "disabled");
+    return true;
+}
+
+// 基于通配符的简单匹配（仅支持'*'）
+static bool wildcard_match(const std::string& text, const std::string& pattern) {
+    size_t t = 0, p = 0, star = std::string::npos, match = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && (pattern[p] == text[t])) {
+            ++t; ++p; // 逐字符匹配
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            match = t;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            t = ++match; // 尝试扩展'*'匹配
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+}
+
+// 获取输入设备名称
+static bool get_input_device_name(const std::string& device_path, std::string& out_name) {
+    int fd = open(device_path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    char name[256] = {0};
+    bool ok = ioctl(fd, EVIOCGNAME(sizeof(name)), name) >= 0;
+    close(fd);
+    if (ok) out_name.assign(name);
+    return ok;
+}
+
+// 从 /dev/input 直接枚举 event 设备并读取名称
+struct InputDevInfo { std::string path; std::string name; };
+static std::vector<InputDevInfo> enumerate_event_devices_via_dev() {
+    std::vector<InputDevInfo> out;
+    DIR* dir = opendir("/dev/input");
     if (!dir) return out;
     struct dirent* de;
     while ((de = readdir(dir)) != nullptr) {
@@ -352,11 +1428,13 @@ static std::vector<InputDevInfo> enumerate_event_devices_via_dev() {
 // 解析 /proc/bus/input/devices 获取名称与 event 映射（fallback）
 static std::vector<InputDevInfo> enumerate_event_devices_via_proc() {
     std::vector<InputDevInfo> out;
-    std::ifstream fin("/proc/bus/input/devices");
-    if (!fin.is_open()) return out;
-    std::string line;
+    FILE* fin = fopen("/proc/bus/input/devices", "r");
+    if (!fin) return out;
+    char buf[512];
     std::string cur_name;
-    while (std::getline(fin, line)) {
+    while (fgets(buf, sizeof(buf), fin)) {
+        std::string line(buf);
+        if (!line.empty() && line.back() == '\n') line.pop_back();
         if (line.rfind("N:", 0) == 0 || line.find("Name=") != std::string::npos) {
             auto pos = line.find("Name=");
             if (pos != std::string::npos) {
@@ -386,6 +1464,7 @@ static std::vector<InputDevInfo> enumerate_event_devices_via_proc() {
             cur_name.clear();
         }
     }
+    fclose(fin);
     return out;
 }
 
@@ -452,393 +1531,2948 @@ static std::vector<std::string> resolve_device_config(const std::string& devices
     return resolved;
 }
 
-// 执行shell脚本 - 内存优化版本
-void execute_script(const std::string& script_name, const std::string& event_type) {
-    // 使用静态缓冲区避免动态分配
-    static char command_buffer[512];
+// 线程角色调度配置：输入/手势线程与动作执行线程分别设置调度策略、优先级与CPU亲和性
+struct SchedRole {
+    const char* name;
+    int policy;      // SCHED_OTHER/SCHED_BATCH/SCHED_IDLE/SCHED_FIFO/SCHED_RR
+    int value;       // 实时策略为rt优先级(1-99)，其余为nice值(-20到19)
+    cpu_set_t cpus;
+    bool has_cpus;
+};
+static SchedRole g_input_role;
+static SchedRole g_action_role;
+
+// 解析CPU列表，支持逗号分隔与区间，例如 "0,1" 或 "4-7"
+static bool parse_cpu_list(const std::string& cpu_str, cpu_set_t& cpu_set) {
+    CPU_ZERO(&cpu_set);
+    bool has_valid_cpu = false;
+    size_t pos = 0;
     
-    // 直接构建命令字符串
-    snprintf(command_buffer, sizeof(command_buffer), 
-             "sh /data/adb/modules/kctrl/scripts/%s %s", 
-             script_name.c_str(), event_type.c_str());
+    while (pos < cpu_str.length()) {
+        size_t comma_pos = cpu_str.find(',', pos);
+        std::string cpu_num_str = cpu_str.substr(pos, comma_pos == std::string::npos ? std::string::npos : comma_pos - pos);
+        
+        // 去除空格
+        cpu_num_str.erase(0, cpu_num_str.find_first_not_of(" \t"));
+        cpu_num_str.erase(cpu_num_str.find_last_not_of(" \t") + 1);
+        
+        if (!cpu_num_str.empty()) {
+            size_t dash_pos = cpu_num_str.find('-');
+            int first = std::atoi(cpu_num_str.c_str());
+            int last = (dash_pos == std::string::npos) ? first : std::atoi(cpu_num_str.c_str() + dash_pos + 1);
+            for (int cpu_num = first; cpu_num <= last; cpu_num++) {
+                if (cpu_num >= 0 && cpu_num < CPU_SETSIZE) {
+                    CPU_SET(cpu_num, &cpu_set);
+                    has_valid_cpu = true;
+                } else {
+                    LOGW("Invalid CPU number: %d", cpu_num);
+                }
+            }
+        }
+        
+        if (comma_pos == std::string::npos) break;
+        pos = comma_pos + 1;
+    }
+    return has_valid_cpu;
+}
+
+// 从配置中解析线程角色：<prefix>_sched=<策略>:<值>，<prefix>_cpu_affinity=<CPU列表>
+// 未单独配置亲和性时沿用全局cpu_affinity
+static void parse_sched_role(SchedRole& role, const char* name, const char* prefix,
+                             int default_policy, int default_value) {
+    role.name = name;
+    role.policy = default_policy;
+    role.value = default_value;
     
-    LOGI("Executing: %s", command_buffer);
+    char key[64];
+    snprintf(key, sizeof(key), "%s_sched", prefix);
+    std::string_view spec = config_get(key);
+    if (!spec.empty()) {
+        size_t colon = spec.find(':');
+        std::string_view policy = spec.substr(0, colon);
+        int value = (colon == std::string_view::npos) ? 0 : sv_to_int(spec.substr(colon + 1));
+        if (policy == "fifo") role.policy = SCHED_FIFO;
+        else if (policy == "rr") role.policy = SCHED_RR;
+        else if (policy == "batch") role.policy = SCHED_BATCH;
+        else if (policy == "idle") role.policy = SCHED_IDLE;
+        else if (policy == "nice") role.policy = SCHED_OTHER;
+        else LOGW("Unknown scheduling policy for %s: %s", name, spec.data());
+        role.value = value;
+    }
     
-    int result = system(command_buffer);
-    if (result == -1) {
-        LOGE("Failed to execute script: %s", strerror(errno));
-    } else {
-        LOGI("Script executed with result: %d", result);
+    snprintf(key, sizeof(key), "%s_cpu_affinity", prefix);
+    std::string_view cpus = config_get(key);
+    if (cpus.empty()) cpus = config_get("cpu_affinity");
+    role.has_cpus = !cpus.empty() && parse_cpu_list(std::string(cpus), role.cpus);
+    if (!role.has_cpus) {
+        // 如果没有有效的CPU配置，默认使用CPU0
+        CPU_ZERO(&role.cpus);
+        CPU_SET(0, &role.cpus);
+        role.has_cpus = true;
     }
 }
 
-// 处理按键事件类型识别 - 内存优化版本
-void handle_key_event_type(int keycode, const std::string& event_type, int duration_ms = 0) {
-    // 每次事件触发前重新加载配置文件，实现实时更新
-    const char* config_file = "/data/adb/modules/kctrl/config.txt";
-    if (!load_config(config_file)) {
-        LOGE("Failed to reload config file before event handling");
-        return;
+// 将调度角色应用到调用线程；nice、调度策略与亲和性均为线程属性，其fork出的子进程会继承
+static void apply_sched_role(const SchedRole& role) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    bool realtime = (role.policy == SCHED_FIFO || role.policy == SCHED_RR);
+    if (realtime) param.sched_priority = role.value;
+    if (sched_setscheduler(0, role.policy, &param) == -1) {
+        LOGW("Failed to set %s scheduling policy: %s", role.name, strerror(errno));
     }
+    if (!realtime && setpriority(PRIO_PROCESS, gettid(), role.value) == -1) {
+        LOGW("Failed to set %s nice=%d: %s", role.name, role.value, strerror(errno));
+    }
+    if (role.has_cpus && sched_setaffinity(0, sizeof(role.cpus), &role.cpus) == -1) {
+        LOGW("Failed to set %s CPU affinity: %s", role.name, strerror(errno));
+    }
+    LOGI("%s thread: policy=%d value=%d CPUs=%d", role.name, role.policy, role.value,
+         CPU_COUNT(&role.cpus));
+}
+
+// 传给动作的手势上下文，同时作为二进制记录的布局（小端，定长，字符串以NUL结尾）
+#define ACTION_CONTEXT_MAGIC 0x5854434Bu  // "KCTX"
+#define ACTION_CONTEXT_VERSION 1
+#define ACTION_CONTEXT_FD 9               // 子进程中读取二进制记录的fd（sh只支持0-9的重定向）
+struct ActionContext {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;           // sizeof(ActionContext)，便于以后追加字段
+    uint16_t keycode;
+    uint8_t gesture;         // GestureId
+    uint8_t clicks;          // 单击/双击判定时的点击次数
+    uint32_t duration_ms;    // 按压时长（单击/双击为最后一次按压）
+    uint64_t time_ns;        // 触发手势的内核事件时间（CLOCK_MONOTONIC）
+    uint64_t dispatch_ns;    // 分发时间（CLOCK_MONOTONIC）
+    uint64_t seq;            // 分发序号
+    char device[64];
+    char profile[32];
+};
+
+// 动作执行请求，由输入线程入队、动作线程执行；定长，入队时不做堆分配
+#define SCRIPT_NAME_MAX 128
+struct ActionRequest {
+    char script_name[SCRIPT_NAME_MAX];  // 复制一份，配置重载后arena中的原串可能已释放
+    const char* event_type = nullptr;   // 指向静态的手势名
+    int script_fd = -1;
+    uint16_t keycode = 0;
+    bool serialize = false;   // 同一按键的动作不并发执行
+    ActionContext context;
+};
+
+// 执行shell脚本 - 内存优化版本
+// script_fd为预加载脚本memfd的副本（由本函数关闭），-1时回退到磁盘路径
+// 手势上下文通过KCTRL_*环境变量传递，开启action_context_fd时另在ACTION_CONTEXT_FD上提供二进制记录
+// 在动作执行线程中运行；调用方已为本次执行获取g_action_wake，执行结束后在此释放
+void execute_script(const ActionRequest& request) {
+    const ActionContext& ctx = request.context;
+    int script_fd = request.script_fd;
+    bool context_fd = g_action_context_fd.load(std::memory_order_relaxed);
     
-    // 使用静态缓冲区避免重复分配
-    static char script_key_buffer[64];
-    
-    // 直接构建脚本键名，避免字符串拼接
-    const char* suffix;
-    if (event_type == "click") {
-        suffix = "_click";
-    } else if (event_type == "double_click") {
-        suffix = "_double_click";
-    } else if (event_type == "short_press") {
-        suffix = "_short_press";
-    } else if (event_type == "long_press") {
-        suffix = "_long_press";
+    // 使用栈上缓冲区，避免多个动作线程共享静态缓冲区
+    char script_path[320];
+    if (script_fd != -1) {
+        snprintf(script_path, sizeof(script_path), "/proc/self/fd/%d", script_fd);
     } else {
-        return; // 不支持的事件类型
+        snprintf(script_path, sizeof(script_path), "%s/%s/%s", g_data_dir.c_str(), SCRIPTS_DIR, request.script_name);
     }
     
-    snprintf(script_key_buffer, sizeof(script_key_buffer), "script_%d%s", keycode, suffix);
+    // 环境变量：继承的环境之后追加手势上下文，全部位于栈上
+    char env_event[48], env_keycode[32], env_duration[40], env_clicks[32], env_time[48];
+    char env_seq[48], env_device[96], env_profile[64], env_context_fd[32];
+    snprintf(env_event, sizeof(env_event), "KCTRL_EVENT=%s", request.event_type);
+    snprintf(env_keycode, sizeof(env_keycode), "KCTRL_KEYCODE=%u", ctx.keycode);
+    snprintf(env_duration, sizeof(env_duration), "KCTRL_DURATION_MS=%u", ctx.duration_ms);
+    snprintf(env_clicks, sizeof(env_clicks), "KCTRL_CLICKS=%u", ctx.clicks);
+    snprintf(env_time, sizeof(env_time), "KCTRL_TIME_NS=%llu", (unsigned long long)ctx.time_ns);
+    snprintf(env_seq, sizeof(env_seq), "KCTRL_SEQ=%llu", (unsigned long long)ctx.seq);
+    snprintf(env_device, sizeof(env_device), "KCTRL_DEVICE=%s", ctx.device);
+    snprintf(env_profile, sizeof(env_profile), "KCTRL_PROFILE=%s", ctx.profile);
+    snprintf(env_context_fd, sizeof(env_context_fd), "KCTRL_CONTEXT_FD=%d", ACTION_CONTEXT_FD);
     
-    auto it = g_config.find(script_key_buffer);
-    if (it != g_config.end()) {
-        // 移除文件日志记录，直接执行脚本
-        std::thread script_thread(execute_script, it->second, event_type);
-        script_thread.detach();
+    const size_t ENV_MAX = 256;
+    char* envp[ENV_MAX];
+    size_t env_count = 0;
+    for (char** env = environ; env && *env && env_count < ENV_MAX - 10; env++) {
+        if (strncmp(*env, "KCTRL_", 6) != 0) envp[env_count++] = *env;
     }
-}
-
-// 处理双击检测定时器 - 内存优化版本
-void double_click_timer(int keycode) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(g_double_click_interval));
+    envp[env_count++] = env_event;
+    envp[env_count++] = env_keycode;
+    envp[env_count++] = env_duration;
+    envp[env_count++] = env_clicks;
+    envp[env_count++] = env_time;
+    envp[env_count++] = env_seq;
+    envp[env_count++] = env_device;
+    envp[env_count++] = env_profile;
+    if (context_fd) envp[env_count++] = env_context_fd;
+    envp[env_count] = nullptr;
+    char* argv[] = { const_cast<char*>("sh"), script_path, const_cast<char*>(request.event_type), nullptr };
     
-    // 减少锁持有时间，先读取状态再处理
-    uint8_t click_count;
-    bool timer_active;
+    LOGI("Executing: sh %s %s (%s)", script_path, request.event_type, request.script_name);
     
-    {
-        std::lock_guard<std::mutex> lock(g_global_mutex);
-        auto& state = g_key_states[keycode];
-        click_count = state.click_count();
-        timer_active = state.timer_active();
-        
-        if (timer_active) {
-            state.set_click_count(0);
-            state.set_timer_active(false);
+    TRACE_BEGIN(TRACE_SPAWN);
+    pid_t pid = fork();
+    if (pid > 0) {
+        TRACE_END();
+        flight_record(FR_SPAWN, ctx.keycode, pid, static_cast<int64_t>(ctx.seq));
+    }
+    if (pid == 0) {
+        // 主线程通过signalfd接收信号而屏蔽了它们，脚本需要恢复默认信号掩码
+        sigset_t empty_mask;
+        sigemptyset(&empty_mask);
+        sigprocmask(SIG_SETMASK, &empty_mask, nullptr);
+        // 子进程中清除memfd的CLOEXEC，使sh能够通过/proc/self/fd读取脚本
+        if (script_fd != -1) fcntl(script_fd, F_SETFD, 0);
+        if (context_fd) {
+            // 记录小于PIPE_BUF，写入管道后即可关闭写端，脚本从ACTION_CONTEXT_FD读到EOF为止
+            int pipe_fds[2];
+            if (pipe2(pipe_fds, O_CLOEXEC) == 0) {
+                if (write(pipe_fds[1], &ctx, sizeof(ctx)) != static_cast<ssize_t>(sizeof(ctx))) _exit(126);
+                close(pipe_fds[1]);
+                if (pipe_fds[0] == ACTION_CONTEXT_FD) {
+                    fcntl(pipe_fds[0], F_SETFD, 0);
+                } else {
+                    dup2(pipe_fds[0], ACTION_CONTEXT_FD);  // dup2得到的fd不带CLOEXEC
+                }
+            }
         }
+        execve("/system/bin/sh", argv, envp);
+        _exit(127);
     }
+    if (script_fd != -1) close(script_fd);
     
-    // 在锁外处理事件，减少锁竞争
-    if (timer_active) {
-        if (click_count == 1) {
-            handle_key_event_type(keycode, "click");
-        } else if (click_count >= 2) {
-            handle_key_event_type(keycode, "double_click");
-        }
+    if (pid == -1) {
+        TRACE_END();
+        LOGE("Failed to execute script: %s", strerror(errno));
+    } else {
+        int status = 0;
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+        flight_record(FR_EXIT, ctx.keycode, pid, status);
+        LOGI("Script executed with result: %d", status);
     }
+    wake_source_release(g_action_wake);
 }
 
-// 处理按键释放后的事件判断定时器 - 内存优化版本
-void key_release_timer(int keycode, long long duration) {
-    // 直接处理事件，无需锁定状态
-    if (duration >= g_long_press_threshold) {
-        // 长按事件
-        handle_key_event_type(keycode, "long_press", duration);
-    } else if (duration > g_click_threshold) {
-        // 短按事件
-        handle_key_event_type(keycode, "short_press", duration);
-    }
-    // 点击事件在双击检测定时器中处理
+// 固定数量的动作执行线程，使用独立的调度角色
+// 请求队列有上限（action_queue_max），满时按绑定的策略丢弃新请求或挤掉最早的请求
+// 队列按上限预留容量，入队不做堆分配；请求数很少，出队时整体前移即可
+static std::mutex g_action_mutex;
+static std::condition_variable g_action_cv;
+static std::vector<ActionRequest> g_action_queue;
+static std::vector<std::thread> g_action_threads;
+static bool g_action_stop = false;
+static uint8_t g_action_key_busy[KEY_CNT];  // 正在执行的serialize动作所属按键
+
+// 动作队列计数（受g_action_mutex保护，限速计数仅事件循环线程修改）
+static uint64_t g_action_enqueued = 0;
+static uint64_t g_action_dropped = 0;      // 队列满时丢弃的新请求
+static uint64_t g_action_evicted = 0;      // 队列满时被挤掉的请求
+static uint64_t g_action_coalesced = 0;
+static uint64_t g_action_rate_limited = 0;
+static size_t g_action_queue_peak = 0;
+static uint64_t g_action_started = 0;
+static uint64_t g_action_wait_ns_total = 0;  // 入队到开始执行的等待时间
+static uint64_t g_action_wait_ns_max = 0;
+
+// 丢弃一个尚未执行的请求，释放其持有的资源
+static void discard_action_request(ActionRequest& request) {
+    if (request.script_fd != -1) close(request.script_fd);
+    request.script_fd = -1;
+    wake_source_release(g_action_wake);
 }
 
-// 监听输入设备事件
-void monitor_input_device(const std::string& device_path) {
-    int fd = open(device_path.c_str(), O_RDONLY);
-    if (fd == -1) {
-        LOGE("Failed to open input device %s: %s", device_path.c_str(), strerror(errno));
-        return;
+// 取出第一个可以执行的请求（serialize请求需等待同一按键的上一个动作结束）
+static bool take_action_request(ActionRequest& request) {
+    for (auto it = g_action_queue.begin(); it != g_action_queue.end(); ++it) {
+        if (it->serialize && g_action_key_busy[it->keycode]) continue;
+        request = std::move(*it);
+        g_action_queue.erase(it);
+        if (request.serialize) g_action_key_busy[request.keycode] = 1;
+        uint64_t wait_ns = monotonic_ns() - request.context.dispatch_ns;
+        g_action_started++;
+        g_action_wait_ns_total += wait_ns;
+        if (wait_ns > g_action_wait_ns_max) g_action_wait_ns_max = wait_ns;
+        return true;
     }
+    return false;
+}
+
+// 动作执行线程：以动作调度角色运行，脚本子进程继承其优先级与CPU亲和性
+static void action_worker() {
+    apply_sched_role(g_action_role);
     
-    LOGI("Monitoring input device: %s", device_path.c_str());
-    
-    struct input_event ev;
-    while (g_running) {
-        ssize_t bytes = read(fd, &ev, sizeof(ev));
-        if (bytes == sizeof(ev)) {
-            // 只处理按键事件
-            if (ev.type == EV_KEY) {
-                if (ev.value == 1) {
-                    // 按键按下
-                    std::lock_guard<std::mutex> lock(g_global_mutex);
-                    auto& state = g_key_states[ev.code];
-                    
-                    state.set_pressed(true);
-                    state.press_time_ns = std::chrono::steady_clock::now().time_since_epoch().count();
-                    
-                    LOGI("Key pressed: %d", ev.code);
-                    
-                    // 按下时不触发任何脚本，等待释放时判断事件类型
-                    
-                } else if (ev.value == 0) {
-                    // 按键释放
-                    std::lock_guard<std::mutex> lock(g_global_mutex);
-                    auto& state = g_key_states[ev.code];
-                    
-                    if (state.is_pressed()) {
-                         state.set_pressed(false);
-                         auto release_time_ns = std::chrono::steady_clock::now().time_since_epoch().count();
-                         int duration = static_cast<int>((release_time_ns - state.press_time_ns) / 1000000); // 转换为毫秒
-                        
-                        LOGI("Key released: %d (duration: %dms)", ev.code, duration);
-                        
-                        // 判断事件类型
-                        if (duration <= g_click_threshold) {
-                            // 点击事件 - 需要检测单击/双击
-                            state.set_click_count(state.click_count() + 1);
-                            state.last_click_time_ns = release_time_ns;
-                            
-                            if (!state.timer_active()) {
-                                state.set_timer_active(true);
-                                if (state.timer_thread.joinable()) {
-                                    state.timer_thread.detach();
-                                }
-                                state.timer_thread = std::thread(double_click_timer, ev.code);
-                            }
-                        } else {
-                            // 短按或长按事件 - 使用统一的定时器处理
-                            if (state.timer_thread.joinable()) {
-                                state.timer_thread.detach();
-                            }
-                            state.timer_thread = std::thread(key_release_timer, ev.code, duration);
-                        }
-                        // 按键释放时不触发keyup事件
-                    }
-                } else {
-                    continue; // 忽略重复事件
-                }
+    while (true) {
+        ActionRequest request;
+        {
+            std::unique_lock<std::mutex> lock(g_action_mutex);
+            g_action_cv.wait(lock, [&request]{ return g_action_stop || take_action_request(request); });
+            if (g_action_stop) return;
+        }
+        execute_script(request);
+        if (request.serialize) {
+            {
+                std::lock_guard<std::mutex> lock(g_action_mutex);
+                g_action_key_busy[request.keycode] = 0;
             }
-        } else if (bytes == -1) {
-            if (errno == EINTR) continue;
-            LOGE("Error reading from input device: %s", strerror(errno));
-            break;
+            // 可能有其他线程在等待同一按键
+            g_action_cv.notify_all();
         }
     }
-    
-    close(fd);
-    LOGI("Stopped monitoring input device: %s", device_path.c_str());
 }
 
-// 清理函数
-void cleanup() {
-    g_running = false;
-    
-    // 清理按键状态和线程
+// 启动动作执行线程
+static void start_action_workers(int count) {
+    if (count < 1) count = 1;
+    g_action_threads.reserve(count);
+    for (int i = 0; i < count; i++) {
+        g_action_threads.emplace_back(action_worker);
+    }
+    LOGI("Started %d action thread(s)", count);
+}
+
+// 停止动作执行线程，丢弃尚未执行的请求（等待正在执行的脚本结束）
+static void stop_action_workers() {
     {
-        std::lock_guard<std::mutex> lock(g_global_mutex);
-        for (auto& pair : g_key_states) {
-            auto& state = pair.second;
-            state.set_pressed(false);
-            state.set_timer_active(false);
-            if (state.timer_thread.joinable()) {
-                state.timer_thread.detach();
-            }
-        }
-        g_key_states.clear();
+        std::lock_guard<std::mutex> lock(g_action_mutex);
+        g_action_stop = true;
+        for (auto& request : g_action_queue) discard_action_request(request);
+        g_action_queue.clear();
     }
-    
-    // 恢复系统资源设置
-    munlockall(); // 解锁内存，允许使用swap
-    
-    // 恢复CPU亲和性到所有核心
-    cpu_set_t cpu_set;
-    CPU_ZERO(&cpu_set);
-    for (int i = 0; i < sysconf(_SC_NPROCESSORS_ONLN); i++) {
-        CPU_SET(i, &cpu_set);
+    g_action_cv.notify_all();
+    for (auto& thread : g_action_threads) {
+        if (thread.joinable()) thread.join();
     }
-    sched_setaffinity(0, sizeof(cpu_set), &cpu_set);
-    
-    release_wakelock();
-    unlink("/data/adb/modules/kctrl/mpid.txt");
-    LOGI("Cleanup completed with system resources restored");
+    g_action_threads.clear();
 }
 
-int main(int argc, char* argv[]) {
-    LOGI("KCTRL v2.4 starting...");
-    LOGI("Author: IDlike");
-    LOGI("Description: 适用于Android15+的按键控制模块");
-    
-    // 设置信号处理
-    signal(SIGTERM, signal_handler);
-    signal(SIGINT, signal_handler);
-    
-    // 系统资源优化设置
-    // 1. 降低CPU优先级（nice值越高优先级越低，范围-20到19）
-    if (setpriority(PRIO_PROCESS, 0, 10) == 0) {
-        LOGI("CPU priority lowered to nice=10");
-    } else {
-        LOGW("Failed to lower CPU priority");
-    }
-    
-    // 2. CPU亲和性设置将在加载配置文件后进行
-    
-    // 3. 设置内存策略优先使用swap
-    // 确保内存不被锁定，允许系统将进程内存交换到swap
-    munlockall();
-    
-    // 建议内核优先回收此进程的内存页面
-    if (madvise(nullptr, 0, MADV_DONTNEED) == 0) {
-        LOGI("Memory policy set to prefer swap usage");
-    } else {
-        LOGI("Memory unlocked, will use swap when needed");
+// 被监听的输入设备
+struct InputDevice {
+    std::string path;
+    int fd;
+    int ufd;             // 重映射模式下的uinput设备，-1表示仅监听
+    size_t frame_len;    // 当前SYN帧中已改写的事件数
+    struct input_event frame[64];
+    std::string name;                  // 设备名称（EVIOCGNAME），用于匹配设备级参数与绑定
+    uint16_t slot = 0;                 // 在设备列表中的下标，与按键码组成按键状态的键
+    GestureTiming timing;              // 合并设备级参数后的时间参数
+    uint64_t timing_generation = 0;    // timing对应的配置代数
+    bool stamp_on_read = false;        // 事件时钟无法切换为CLOCK_MONOTONIC，改用读取时刻作为事件时间
+};
+
+// 设备级参数与绑定的设备写法与device配置项相同：绝对路径、eventN、名称或带'*'的通配符
+static bool device_token_matches(const std::string& path, const std::string& name, std::string_view device) {
+    if (!device.empty() && device[0] == '/') return path == device;
+    if (device.compare(0, 5, "event") == 0) {
+        return path.size() > device.size() && path.compare(path.size() - device.size(), device.size(), device) == 0 &&
+               path[path.size() - device.size() - 1] == '/';
     }
+    std::string pattern(device);
+    return !name.empty() && (pattern.find('*') != std::string::npos ? wildcard_match(name, pattern) : name == pattern);
+}
+
+// 处理按键事件类型识别 - 内存优化版本
+// 绑定表按按键码直接索引，手势编号直接定位动作，分发时无需拼接或哈希键名
+// duration_ms/clicks/time_ns/device作为手势上下文随请求传给动作
+static uint64_t g_dispatch_seq = 0;
+void handle_key_event_type(int keycode, GestureId gesture, uint32_t duration_ms, uint8_t clicks,
+                           uint64_t time_ns, const InputDevice* device) {
+    // 配置由inotify在文件变化时重载，此处无需访问存储
     
-    // 4. 极致内存优化设置
-    // 预分配容器以最小容量减少内存碎片
-    g_config.reserve(8);  // 最小配置项数量
-    g_key_states.reserve(4);  // 最多监听4个按键
-    
-    // 设置内存映射建议，优先回收不活跃页面
-    if (madvise(nullptr, 0, MADV_SEQUENTIAL) == 0) {
-        LOGI("Memory access pattern optimized for sequential access");
+    TRACE_BEGIN(TRACE_CONFIG);
+    const ScriptAction* action = nullptr;
+    bool guarded = false;
+    const ProfileTable* profile = g_profile;
+    if (profile && keycode >= 0 && keycode < KEY_CNT && profile->key_index[keycode] != NO_BINDING) {
+        // 取第一条设备相符且守卫全部成立的绑定，守卫只比较缓存的状态值，不访问文件
+        for (action = profile->bindings[profile->key_index[keycode]].actions[gesture]; action; action = action->next) {
+            if (!action->device.empty() &&
+                !(device && device_token_matches(device->path, device->name, action->device))) continue;
+            if (guards_pass(*action)) break;
+            guarded = true;
+        }
     }
-    
-    // 检查单实例运行
-    if (!check_single_instance()) {
-        LOGE("Another instance is already running");
-        return 1;
+    flight_record(FR_DISPATCH, static_cast<uint16_t>(keycode), gesture,
+                  action ? DISPATCH_BOUND : guarded ? DISPATCH_GUARDED : DISPATCH_UNBOUND);
+    if (!action) {
+        if (guarded) g_guard_blocked++;
+        TRACE_END();
+        return;
     }
-    
-    // 获取WakeLock
-    if (!acquire_wakelock()) {
-        LOGE("Failed to acquire wake lock");
-        cleanup();
-        return 1;
+    if (action->profile >= 0) {
+        // 切换方案在事件循环中直接完成，不经过动作线程
+        switch_profile(g_cfg->profiles[action->profile].name);
+        TRACE_END();
+        return;
     }
     
-    // 加载配置文件
-    const char* config_file = (argc > 1) ? argv[1] : "/data/adb/modules/kctrl/config.txt";
-    if (!load_config(config_file)) {
-        LOGE("Failed to load config file");
-        cleanup();
-        return 1;
+    // 令牌桶限速（GCRA）：每个绑定独立计数，在复制memfd之前判断
+    const ActionPolicy& policy = action->policy;
+    if (policy.rate_count > 0) {
+        uint64_t now_ns = monotonic_ns();
+        uint64_t interval_ns = static_cast<uint64_t>(policy.rate_period_ms) * 1000000ULL / policy.rate_count;
+        uint64_t burst_ns = static_cast<uint64_t>(policy.rate_period_ms) * 1000000ULL - interval_ns;
+        if (policy.rate_tat_ns > now_ns + burst_ns) {
+            g_action_rate_limited++;
+            flight_record(FR_DROP, static_cast<uint16_t>(keycode), DROP_RATE_LIMITED, 0);
+            TRACE_END();
+            return;
+        }
+        policy.rate_tat_ns = std::max(policy.rate_tat_ns, now_ns) + interval_ns;
     }
     
-    // 设置CPU亲和性（在加载配置文件后）
-    std::string cpu_affinity_config = "0"; // 默认使用CPU0
-    auto cpu_it = g_config.find("cpu_affinity");
-    if (cpu_it != g_config.end()) {
-        cpu_affinity_config = cpu_it->second;
-        LOGI("Found CPU affinity config: %s", cpu_affinity_config.c_str());
-    } else {
-        LOGI("No CPU affinity config found, using default: CPU0");
+    int script_fd = -1;
+    if (action->script_fd != -1) {
+        // 复制一份memfd，避免执行期间配置重载关闭它；取10以上的fd，不与ACTION_CONTEXT_FD冲突
+        script_fd = fcntl(action->script_fd, F_DUPFD_CLOEXEC, 10);
     }
     
-    cpu_set_t cpu_set;
-    CPU_ZERO(&cpu_set);
-    
-    // 解析CPU亲和性配置
-    std::string cpu_str = cpu_affinity_config;
-    size_t pos = 0;
-    bool has_valid_cpu = false;
+    // 请求与上下文均为定长，直接在栈上构造
+    ActionRequest request;
+    snprintf(request.script_name, sizeof(request.script_name), "%s", action->script.data());
+    request.event_type = gesture_name(gesture);
+    request.script_fd = script_fd;
+    request.keycode = static_cast<uint16_t>(keycode);
+    request.serialize = (policy.flags & POLICY_SERIALIZE) != 0;
+    ActionContext& ctx = request.context;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.magic = ACTION_CONTEXT_MAGIC;
+    ctx.version = ACTION_CONTEXT_VERSION;
+    ctx.size = sizeof(ActionContext);
+    ctx.keycode = static_cast<uint16_t>(keycode);
+    ctx.gesture = static_cast<uint8_t>(gesture);
+    ctx.clicks = clicks;
+    ctx.duration_ms = duration_ms;
+    ctx.time_ns = time_ns;
+    ctx.dispatch_ns = monotonic_ns();
+    ctx.seq = ++g_dispatch_seq;
+    snprintf(ctx.device, sizeof(ctx.device), "%s", device ? device->path.c_str() : "");
+    snprintf(ctx.profile, sizeof(ctx.profile), "%s", profile->name.data());
+    TRACE_END();
     
-    while (pos < cpu_str.length()) {
-        size_t comma_pos = cpu_str.find(',', pos);
-        std::string cpu_num_str = cpu_str.substr(pos, comma_pos == std::string::npos ? std::string::npos : comma_pos - pos);
-        
-        // 去除空格
-        cpu_num_str.erase(0, cpu_num_str.find_first_not_of(" \t"));
-        cpu_num_str.erase(cpu_num_str.find_last_not_of(" \t") + 1);
-        
-        if (!cpu_num_str.empty()) {
-            int cpu_num = std::atoi(cpu_num_str.c_str());
-            if (cpu_num >= 0 && cpu_num < CPU_SETSIZE) {
-                CPU_SET(cpu_num, &cpu_set);
-                has_valid_cpu = true;
-                LOGI("Added CPU %d to affinity set", cpu_num);
-            } else {
-                LOGW("Invalid CPU number: %d", cpu_num);
+    // 在手势唤醒锁释放前接过动作唤醒锁，避免两者之间出现可挂起的空隙
+    wake_source_acquire(g_action_wake);
+    DropReason reason = DROP_QUEUE_FULL;
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(g_action_mutex);
+        size_t queue_max = g_action_queue_max.load(std::memory_order_relaxed);
+        bool merged = false;
+        if (policy.flags & POLICY_COALESCE) {
+            // 队列中已有同一绑定（按键、手势、脚本相同）尚未执行的请求时合并
+            for (const auto& pending : g_action_queue) {
+                if (pending.keycode == request.keycode && pending.event_type == request.event_type &&
+                    strcmp(pending.script_name, request.script_name) == 0) {
+                    merged = true;
+                    break;
+                }
             }
         }
-        
-        if (comma_pos == std::string::npos) break;
-        pos = comma_pos + 1;
-    }
-    
-    // 如果没有有效的CPU配置，默认使用CPU0
-    if (!has_valid_cpu) {
-        CPU_SET(0, &cpu_set);
-        LOGI("No valid CPU affinity config found, using default CPU 0");
-    }
-    
-    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
-        LOGI("CPU affinity set successfully");
-    } else {
-        LOGW("Failed to set CPU affinity");
+        if (merged) {
+            g_action_coalesced++;
+            reason = DROP_COALESCED;
+        } else if (g_action_queue.size() >= queue_max && !(policy.flags & POLICY_DROP_OLDEST)) {
+            g_action_dropped++;
+        } else {
+            if (g_action_queue.size() >= queue_max) {
+                // 挤掉最早的请求
+                ActionRequest& oldest = g_action_queue.front();
+                flight_record(FR_DROP, oldest.keycode, DROP_EVICTED, 0);
+                discard_action_request(oldest);
+                g_action_queue.erase(g_action_queue.begin());
+                g_action_evicted++;
+            }
+            if (g_action_queue.capacity() < queue_max) g_action_queue.reserve(queue_max);
+            g_action_queue.push_back(std::move(request));
+            g_action_enqueued++;
+            if (g_action_queue.size() > g_action_queue_peak) g_action_queue_peak = g_action_queue.size();
+            queued = true;
+        }
     }
-    
-    // 获取要监听的设备路径
-    auto device_it = g_config.find("device");
-    if (device_it == g_config.end()) {
-        LOGE("No device specified in config file");
-        cleanup();
-        return 1;
+    if (!queued) {
+        flight_record(FR_DROP, static_cast<uint16_t>(keycode), reason, 0);
+        discard_action_request(request);
+        return;
     }
+    g_action_cv.notify_one();
+}
+
+// 手势识别延迟：从手势确定的时刻（释放事件时间或双击窗口截止时间）到分发，仅事件循环线程修改
+static uint64_t g_gesture_count = 0;
+static uint64_t g_gesture_latency_ns_total = 0;
+static uint64_t g_gesture_latency_ns_max = 0;
 
-    std::string devices_config = device_it->second;
-    LOGI("Device config: %s", devices_config.c_str());
+static inline void note_gesture_latency(uint64_t due_ns) {
+    uint64_t now_ns = monotonic_ns();
+    uint64_t latency_ns = now_ns > due_ns ? now_ns - due_ns : 0;
+    g_gesture_count++;
+    g_gesture_latency_ns_total += latency_ns;
+    if (latency_ns > g_gesture_latency_ns_max) g_gesture_latency_ns_max = latency_ns;
+}
 
-    // 新增：支持通过设备名称/通配符解析为实际路径
-    std::vector<std::string> device_paths = resolve_device_config(devices_config);
+// 双击窗口定时器（timerfd，始终按最早的截止时间设置）
+static int g_timer_fd = -1;
 
-    if (device_paths.empty()) {
-        LOGE("No valid device paths found");
-        cleanup();
-        return 1;
-    }
+inline uint64_t KernelClock::now_ns() {
+    return monotonic_ns();
+}
 
-    LOGI("Found %zu device(s) to monitor", device_paths.size());
-    for (const auto& path : device_paths) {
-        LOGI("Target device: %s", path.c_str());
+void LoopTimer::arm(uint64_t deadline_ns) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its)); // 全0表示解除定时器
+    if (deadline_ns != 0) {
+        its.it_value.tv_sec = deadline_ns / 1000000000ULL;
+        its.it_value.tv_nsec = deadline_ns % 1000000000ULL;
     }
+    timerfd_settime(g_timer_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+    flight_record(FR_TIMER_ARM, 0, 0, static_cast<int64_t>(deadline_ns));
+}
+
+// 处理双击检测定时器到期
+static void handle_click_timer() {
+    uint64_t expirations;
+    if (read(g_timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+    TRACE_BEGIN(TRACE_TIMER);
+    g_gestures.timer_expired();
+    TRACE_END();
+}
 
-    // 为每个设备启动独立的监听线程
-    std::vector<std::thread> monitor_threads;
-    monitor_threads.reserve(device_paths.size());
+// 配置文件与脚本目录的inotify监听
+static int g_config_wd = -1;
+static int g_scripts_wd = -1;
+static std::string g_config_base;
 
-    for (const auto& device_path : device_paths) {
-        monitor_threads.emplace_back(monitor_input_device, device_path);
+// 监听配置文件所在目录与脚本目录，返回inotify fd
+static int setup_config_watch() {
+    int ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (ifd == -1) {
+        LOGE("inotify_init1 failed: %s", strerror(errno));
+        return -1;
     }
     
-    // 主循环 - 使用条件变量优化响应性和定期内存回收
-    {
-        std::unique_lock<std::mutex> lock(g_global_mutex);
-        while (g_running) {
-            // 等待5分钟或直到程序退出
-            if (g_shutdown_cv.wait_for(lock, std::chrono::minutes(5), []{ return !g_running; })) {
-                break; // 程序退出
-            }
-            
-            // 定期内存优化（每5分钟执行一次）
-            if (g_running) {
-                // 建议内核回收不活跃的内存页面
-                madvise(nullptr, 0, MADV_DONTNEED);
-                
-                // 清理可能的内存碎片
-                g_config.rehash(0);
-                g_key_states.rehash(0);
-                
-                LOGI("Periodic memory optimization completed");
-            }
+    // 监听配置文件所在目录，以便捕获编辑器的"写临时文件再重命名"
+    std::string config_dir = ".";
+    g_config_base = g_config_path;
+    size_t slash = g_config_path.find_last_of('/');
+    if (slash != std::string::npos) {
+        config_dir = g_config_path.substr(0, slash ? slash : 1);
+        g_config_base = g_config_path.substr(slash + 1);
+    }
+    g_config_wd = inotify_add_watch(ifd, config_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    std::string scripts_dir = data_path(SCRIPTS_DIR);
+    g_scripts_wd = inotify_add_watch(ifd, scripts_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    if (g_config_wd == -1) LOGW("Failed to watch %s: %s", config_dir.c_str(), strerror(errno));
+    if (g_scripts_wd == -1) LOGW("Failed to watch %s: %s", scripts_dir.c_str(), strerror(errno));
+    return ifd;
+}
+
+// 处理配置/脚本变化，变化时重新加载配置并重新预加载脚本
+static void handle_config_watch(int ifd) {
+    alignas(struct inotify_event) char buf[4096];
+    bool reload = false;
+    ssize_t len;
+    while ((len = read(ifd, buf, sizeof(buf))) > 0) {
+        for (char* ptr = buf; ptr < buf + len; ) {
+            auto* event = reinterpret_cast<struct inotify_event*>(ptr);
+            if (handle_state_inotify(event->wd)) {
+                // 状态文件变化只更新缓存，不重载配置
+            } else if (event->wd == g_scripts_wd) {
+                reload = true;
+            } else if (event->wd == g_config_wd && event->len > 0 && g_config_base == event->name) {
+                reload = true;
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    
+    if (reload) {
+        LOGI("Config or scripts changed, reloading");
+        load_config(g_config_path.c_str());
+    }
+}
+
+// 控制套接字：抽象命名空间的Unix数据报套接字，只接受root或同用户发送的命令
+// 目前支持的命令：profile <名称>、upgrade [新二进制路径]
+#define CONTROL_SOCKET_NAME "kctrl"
+
+// 无中断升级：旧进程启动新二进制，经socketpair用SCM_RIGHTS交出输入设备fd、控制套接字与按键状态
+static std::string g_argv0 = "kctrl";     // 启动时的argv[0]（klaunch会设置伪装名），升级后沿用
+static bool g_upgrade_requested = false;
+static std::string g_upgrade_binary;      // 空表示使用当前可执行文件的路径
+static int g_handoff_fd = -1;             // 旧进程：等待新进程就绪；新进程：检测旧进程退出
+static pid_t g_handoff_pid = -1;          // 旧进程中正在接管的新进程
+static bool g_handed_off = false;         // 设备已属于另一个进程：退出时不释放独占、不销毁uinput、不删除PID文件
+
+// 就绪通知：klaunch --supervise 经环境变量KCTRL_READY_FD传入管道写端，设备接入后写入"<pid>\n"
+// 升级时该fd随新进程一起跨越exec，新进程接管后同样写入自己的pid，监护进程据此改为监视新进程而不是重启
+#define READY_FD_ENV "KCTRL_READY_FD"
+static int g_ready_fd = -1;
+
+static void open_ready_fd() {
+    const char* value = getenv(READY_FD_ENV);
+    if (!value) return;
+    int fd = atoi(value);
+    if (fd > 2 && fcntl(fd, F_SETFD, FD_CLOEXEC) != -1) g_ready_fd = fd;  // 不让脚本继承
+}
+
+static void notify_ready() {
+    if (g_ready_fd == -1) return;
+    char line[16];
+    int n = snprintf(line, sizeof(line), "%d\n", getpid());
+    if (write(g_ready_fd, line, n) != n) LOGW("Failed to notify readiness: %s", strerror(errno));
+}
+
+static socklen_t control_socket_address(struct sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, CONTROL_SOCKET_NAME, strlen(CONTROL_SOCKET_NAME));  // sun_path[0]=0为抽象地址
+    return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + 1 + strlen(CONTROL_SOCKET_NAME));
+}
+
+static int setup_control_socket() {
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        LOGW("Failed to create control socket: %s", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_un addr;
+    socklen_t len = control_socket_address(addr);
+    int on = 1;
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), len) == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) == -1) {
+        LOGW("Failed to set up control socket: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 处理控制命令
+static void handle_control_socket(int fd) {
+    char buf[PATH_MAX + 16];
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(struct ucred))];
+    while (true) {
+        struct iovec iov = { buf, sizeof(buf) - 1 };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(fd, &msg, 0);
+        if (n < 0) break;
+        
+        const struct ucred* cred = nullptr;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_CREDENTIALS) {
+                cred = reinterpret_cast<const struct ucred*>(CMSG_DATA(cmsg));
+            }
+        }
+        if (!cred || (cred->uid != 0 && cred->uid != getuid())) {
+            LOGW("Rejected control command from uid %d", cred ? (int)cred->uid : -1);
+            continue;
+        }
+        
+        std::string_view command = sv_trim(std::string_view(buf, n));
+        while (!command.empty() && command.back() == '\n') command = sv_trim(command.substr(0, command.size() - 1));
+        if (command.compare(0, 8, "profile ") == 0) {
+            switch_profile(sv_trim(command.substr(8)));
+        } else if (command == "upgrade" || command.compare(0, 8, "upgrade ") == 0) {
+            // 在事件循环本轮处理结束后启动新进程
+            g_upgrade_requested = true;
+            g_upgrade_binary.assign(sv_trim(command.substr(7)));
+        } else {
+            LOGW("Unknown control command: %.*s", (int)command.size(), command.data());
+        }
+    }
+}
+
+// 向正在运行的kctrl发送控制命令：<动词> [参数]
+static int send_control_command(const char* verb, const char* arg) {
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        fprintf(stderr, "socket failed: %s\n", strerror(errno));
+        return 1;
+    }
+    struct sockaddr_un addr;
+    socklen_t len = control_socket_address(addr);
+    char command[PATH_MAX + 16];
+    int n = (arg && *arg) ? snprintf(command, sizeof(command), "%s %s", verb, arg) :
+                            snprintf(command, sizeof(command), "%s", verb);
+    if (n < 0 || static_cast<size_t>(n) >= sizeof(command)) {
+        fprintf(stderr, "Command argument too long\n");
+        close(fd);
+        return 1;
+    }
+    if (sendto(fd, command, n, 0, reinterpret_cast<struct sockaddr*>(&addr), len) == -1) {
+        fprintf(stderr, "kctrl is not running or cannot be reached: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+// kctrl --upgrade [新二进制]：通知正在运行的kctrl启动新二进制并交出设备，等待PID文件指向新进程
+static int send_upgrade_command(const char* binary) {
+    char resolved[PATH_MAX] = "";
+    if (binary && (!realpath(binary, resolved) || access(resolved, X_OK) != 0)) {
+        fprintf(stderr, "Not an executable: %s\n", binary);
+        return 1;
+    }
+    int old_pid = read_pid_file();
+    int rc = send_control_command("upgrade", resolved);
+    if (rc != 0) return rc;
+    for (int i = 0; i < 50; i++) {
+        usleep(100000);
+        int pid = read_pid_file();
+        if (pid > 0 && pid != old_pid && kill(pid, 0) == 0) {
+            printf("kctrl upgraded: pid %d -> %d\n", old_pid, pid);
+            return 0;
+        }
+    }
+    fprintf(stderr, "Upgrade did not complete, the old instance keeps running (see logcat)\n");
+    return 1;
+}
+
+// 去抖统计：丢弃的抖动总数与各按键的抖动次数
+static uint64_t g_debounce_filtered = 0;
+static std::unordered_map<uint16_t, uint32_t> g_debounce_keys;
+
+// 按键的时间参数：按键级 > 设备级 > 全局
+// dev.timing为设备的时间参数（已合并全局参数，由调用方刷新），按键级参数从分发表的按键表项中取出
+static GestureTiming key_timing(const InputDevice& dev, uint16_t code) {
+    GestureTiming timing = dev.timing;
+    const ProfileTable* profile = g_profile;
+    if (profile && code < KEY_CNT && profile->key_index[code] != NO_BINDING) {
+        timing_overlay(timing, profile->bindings[profile->key_index[code]].timing);
+    }
+    return timing;
+}
+
+inline GestureTiming LoopDispatcher::timing(const InputDevice& dev, uint16_t code) {
+    return key_timing(dev, code);
+}
+
+inline void LoopDispatcher::dispatch(uint16_t code, GestureId gesture, uint32_t duration_ms, uint8_t clicks,
+                                     uint64_t time_ns, uint64_t due_ns, const InputDevice* device) {
+    note_gesture_latency(due_ns);
+    handle_key_event_type(code, gesture, duration_ms, clicks, time_ns, device);
+}
+
+inline void LoopDispatcher::pressed(uint16_t code) {
+    LOGI("Key pressed: %d", code);
+}
+
+inline void LoopDispatcher::classified(uint16_t code, int32_t gesture, uint32_t duration_ms, uint64_t time_ns) {
+    LOGI("Key released: %d (duration: %ums)", code, duration_ms);
+    flight_record(FR_CLASSIFY, code, gesture, duration_ms, time_ns);
+}
+
+inline void LoopDispatcher::timer_fired(uint16_t code, uint8_t clicks) {
+    flight_record(FR_TIMER_FIRE, code, clicks, 0);
+}
+
+void LoopDispatcher::bounced(uint16_t code, bool merged, uint64_t gap_ns, uint64_t time_ns) {
+    g_debounce_filtered++;
+    g_debounce_keys[code]++;
+    flight_record(FR_DEBOUNCE, code, merged ? 1 : 0, static_cast<int64_t>(gap_ns), time_ns);
+    LOGI("Key bounce filtered: %d (%lluus after release)", code, (unsigned long long)(gap_ns / 1000));
+}
+
+// 有按键按下或双击窗口未关闭时持有手势唤醒锁，否则释放
+void LoopDispatcher::busy(bool busy) {
+    if (busy) {
+        wake_source_acquire(g_gesture_wake);
+    } else {
+        wake_source_release(g_gesture_wake);
+    }
+}
+
+// 创建与源设备能力一致的uinput设备，用于转发重映射后的事件
+static int create_uinput_clone(int src_fd, const std::string& device_path) {
+    int ufd = open("/dev/uinput", O_WRONLY | O_CLOEXEC);
+    if (ufd == -1) {
+        LOGE("Failed to open /dev/uinput: %s", strerror(errno));
+        return -1;
+    }
+    
+    unsigned long ev_bits[(EV_CNT + 63) / 64] = {0};
+    ioctl(src_fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits);
+    auto test_bit = [](const unsigned long* bits, int bit) {
+        return (bits[bit / (8 * sizeof(long))] >> (bit % (8 * sizeof(long)))) & 1UL;
+    };
+    
+    // 按事件类型复制能力位
+    static const struct { int type; int count; unsigned long req; } caps[] = {
+        { EV_KEY, KEY_CNT, UI_SET_KEYBIT },
+        { EV_REL, REL_CNT, UI_SET_RELBIT },
+        { EV_ABS, ABS_CNT, UI_SET_ABSBIT },
+        { EV_MSC, MSC_CNT, UI_SET_MSCBIT },
+        { EV_SW,  SW_CNT,  UI_SET_SWBIT  },
+        { EV_LED, LED_CNT, UI_SET_LEDBIT },
+    };
+    static unsigned long code_bits[(KEY_CNT + 63) / 64];
+    const uint16_t* remap_table = g_remap_tables[g_remap_active.load(std::memory_order_acquire)];
+    for (const auto& cap : caps) {
+        if (!test_bit(ev_bits, cap.type)) continue;
+        ioctl(ufd, UI_SET_EVBIT, cap.type);
+        memset(code_bits, 0, sizeof(code_bits));
+        ioctl(src_fd, EVIOCGBIT(cap.type, sizeof(code_bits)), code_bits);
+        for (int code = 0; code < cap.count; code++) {
+            if (!test_bit(code_bits, code)) continue;
+            ioctl(ufd, cap.req, code);
+            if (cap.type == EV_KEY && remap_table[code] != REMAP_SUPPRESS) {
+                // 重映射的目标按键也必须声明，否则内核会丢弃
+                ioctl(ufd, UI_SET_KEYBIT, remap_table[code]);
+            }
+            if (cap.type == EV_ABS) {
+                struct uinput_abs_setup abs_setup;
+                memset(&abs_setup, 0, sizeof(abs_setup));
+                abs_setup.code = code;
+                if (ioctl(src_fd, EVIOCGABS(code), &abs_setup.absinfo) == 0) {
+                    ioctl(ufd, UI_ABS_SETUP, &abs_setup);
+                }
+            }
+        }
+    }
+    
+    struct uinput_setup setup;
+    memset(&setup, 0, sizeof(setup));
+    ioctl(src_fd, EVIOCGID, &setup.id);
+    char src_name[64] = {0};
+    ioctl(src_fd, EVIOCGNAME(sizeof(src_name)), src_name);
+    snprintf(setup.name, sizeof(setup.name), "kctrl-remap %s", src_name);
+    
+    if (ioctl(ufd, UI_DEV_SETUP, &setup) == -1 || ioctl(ufd, UI_DEV_CREATE) == -1) {
+        LOGE("Failed to create uinput device for %s: %s", device_path.c_str(), strerror(errno));
+        close(ufd);
+        return -1;
+    }
+    
+    LOGI("Created uinput clone for %s", device_path.c_str());
+    return ufd;
+}
+
+// 按重映射表改写一个SYN帧内的事件并一次性写入uinput
+// frame中存放已改写的事件，frame_len为事件数
+static void forward_frame(int ufd, struct input_event* frame, size_t& frame_len, bool stamp_on_read) {
+    // 仅剩SYN的帧（所有按键都被吞掉）无需转发
+    if (frame_len <= 1) {
+        frame_len = 0;
+        return;
+    }
+    
+    ssize_t bytes = write(ufd, frame, frame_len * sizeof(struct input_event));
+    if (bytes == -1) {
+        LOGE("Failed to write to uinput: %s", strerror(errno));
+        frame_len = 0;
+        return;
+    }
+    
+    // 事件时钟已切换为CLOCK_MONOTONIC的设备可直接与当前时间比较；
+    // 切换失败（stamp_on_read）的设备事件时间为CLOCK_REALTIME，且没有更早的时间点可用，不统计延迟
+    if (!stamp_on_read) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const struct input_event& syn = frame[frame_len - 1];
+        int64_t latency_ns = (static_cast<int64_t>(now.tv_sec) - syn.input_event_sec) * 1000000000LL +
+                             (static_cast<int64_t>(now.tv_nsec) - static_cast<int64_t>(syn.input_event_usec) * 1000);
+        uint64_t lat = latency_ns > 0 ? static_cast<uint64_t>(latency_ns) : 0;
+        g_remap_latency_frames.fetch_add(1, std::memory_order_relaxed);
+        g_remap_latency_ns_total.fetch_add(lat, std::memory_order_relaxed);
+        uint64_t prev_max = g_remap_latency_ns_max.load(std::memory_order_relaxed);
+        while (lat > prev_max && !g_remap_latency_ns_max.compare_exchange_weak(prev_max, lat, std::memory_order_relaxed)) {}
+    }
+    g_remap_frames.fetch_add(1, std::memory_order_relaxed);
+    g_remap_events.fetch_add(frame_len, std::memory_order_relaxed);
+    frame_len = 0;
+}
+
+// 设备的时间参数，每次加载配置后重新解析一次，之后每个事件只比较配置代数
+static const GestureTiming& device_timing(InputDevice& dev) {
+    if (dev.timing_generation == g_cfg_generation) return dev.timing;
+    dev.timing_generation = g_cfg_generation;
+    dev.timing = g_cfg ? g_cfg->timing : GestureTiming{ 200, 1000, 300, 0 };
+    if (!g_cfg || g_cfg->device_timing_count == 0) return dev.timing;
+    for (size_t i = 0; i < g_cfg->device_timing_count; i++) {
+        const DeviceTiming& d = g_cfg->device_timings[i];
+        if (device_token_matches(dev.path, dev.name, d.device)) timing_overlay(dev.timing, d.timing);
+    }
+    LOGI("Gesture timing for %s: click %ums, long %ums, double %ums, debounce %ums", dev.path.c_str(),
+         dev.timing.click_ms, dev.timing.long_ms, dev.timing.double_ms, dev.timing.debounce_ms);
+    return dev.timing;
+}
+
+// 读取设备名称，用于匹配设备级参数与绑定
+static void read_device_name(InputDevice& dev) {
+    char name[256] = {0};
+    dev.name.assign(ioctl(dev.fd, EVIOCGNAME(sizeof(name) - 1), name) >= 0 ? name : "");
+}
+
+// 事件时间切换为CLOCK_MONOTONIC，与双击窗口timerfd同一时钟
+// 失败时内核事件时间仍为CLOCK_REALTIME，按它计算的截止时间远在未来，改为在读取时用monotonic_ns()打时间戳
+static void set_event_clock(InputDevice& dev) {
+    int clock_id = CLOCK_MONOTONIC;
+    dev.stamp_on_read = ioctl(dev.fd, EVIOCSCLOCKID, &clock_id) == -1;
+    if (dev.stamp_on_read) {
+        LOGW("Failed to set event clock for %s: %s, timestamping events on read", dev.path.c_str(), strerror(errno));
+    }
+}
+
+// 打开输入设备；事件时间切换为CLOCK_MONOTONIC，重映射模式下独占设备并创建uinput
+static bool open_input_device(InputDevice& dev) {
+    dev.fd = open(dev.path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    dev.ufd = -1;
+    dev.frame_len = 0;
+    if (dev.fd == -1) {
+        LOGE("Failed to open input device %s: %s", dev.path.c_str(), strerror(errno));
+        return false;
+    }
+    read_device_name(dev);
+    set_event_clock(dev);
+    
+    // 重映射模式：独占设备，事件经改写后从uinput重新发出
+    if (g_remap_enabled) {
+        dev.ufd = create_uinput_clone(dev.fd, dev.path);
+        if (dev.ufd != -1 && ioctl(dev.fd, EVIOCGRAB, 1) == -1) {
+            LOGE("Failed to grab %s: %s", dev.path.c_str(), strerror(errno));
+            ioctl(dev.ufd, UI_DEV_DESTROY);
+            close(dev.ufd);
+            dev.ufd = -1;
+        }
+        if (dev.ufd != -1) {
+            LOGI("Remap enabled for %s", dev.path.c_str());
+        }
+    }
+    
+    LOGI("Monitoring input device: %s", dev.path.c_str());
+    return true;
+}
+
+// 关闭输入设备，释放独占并销毁uinput设备
+// 已交接给新进程时只关闭本进程的fd：独占与uinput设备属于共享的打开文件，由新进程继续持有
+static void close_input_device(InputDevice& dev) {
+    if (g_handed_off) {
+        if (dev.ufd != -1) close(dev.ufd);
+        if (dev.fd != -1) close(dev.fd);
+        dev.ufd = dev.fd = -1;
+        return;
+    }
+    if (dev.ufd != -1) {
+        ioctl(dev.fd, EVIOCGRAB, 0);
+        ioctl(dev.ufd, UI_DEV_DESTROY);
+        close(dev.ufd);
+        dev.ufd = -1;
+    }
+    if (dev.fd != -1) {
+        close(dev.fd);
+        dev.fd = -1;
+        LOGI("Stopped monitoring input device: %s", dev.path.c_str());
+    }
+}
+
+// 处理输入设备可读事件，返回false表示设备已不可用
+static bool handle_device_input(InputDevice& dev) {
+    // 批量读取，一次系统调用处理整个SYN帧
+    struct input_event events[64];
+    TRACE_BEGIN(TRACE_READ);
+    ssize_t bytes = read(dev.fd, events, sizeof(events));
+    if (bytes == -1) {
+        TRACE_END();
+        if (errno == EINTR || errno == EAGAIN) return true;
+        LOGE("Error reading from input device %s: %s", dev.path.c_str(), strerror(errno));
+        return false;
+    }
+    size_t count = bytes / sizeof(struct input_event);
+    
+    // 先转发，保证重映射路径不被手势处理拖慢
+    if (dev.ufd != -1) {
+        const uint16_t* remap_table = g_remap_tables[g_remap_active.load(std::memory_order_acquire)];
+        for (size_t i = 0; i < count; i++) {
+            struct input_event out = events[i];
+            if (out.type == EV_KEY && out.code < KEY_CNT) {
+                uint16_t mapped = remap_table[out.code];
+                if (mapped == REMAP_SUPPRESS) {
+                    g_remap_suppressed.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                out.code = mapped;
+            }
+            dev.frame[dev.frame_len++] = out;
+            if (out.type == EV_SYN || dev.frame_len == sizeof(dev.frame) / sizeof(dev.frame[0])) {
+                forward_frame(dev.ufd, dev.frame, dev.frame_len, dev.stamp_on_read);
+            }
+        }
+    }
+    
+    TRACE_END();
+    
+    // 只处理按键事件
+    device_timing(dev);
+    uint64_t read_ns = (g_flight || dev.stamp_on_read) ? monotonic_ns() : 0;
+    for (size_t i = 0; i < count; i++) {
+        if (events[i].type == EV_KEY) {
+            // 手势识别的时间取自内核事件时间戳（事件时钟未能切换时取读取时刻）
+            uint64_t event_ns = dev.stamp_on_read ? read_ns :
+                                static_cast<uint64_t>(events[i].input_event_sec) * 1000000000ULL +
+                                static_cast<uint64_t>(events[i].input_event_usec) * 1000ULL;
+            if (g_flight) {
+                flight_record(FR_EVENT, events[i].code, events[i].value,
+                              static_cast<int64_t>(read_ns - event_ns), event_ns);
+            }
+            TRACE_BEGIN(TRACE_CLASSIFY);
+            g_gestures.key_event(dev, events[i].code, events[i].value, event_ns);
+            TRACE_END();
+        }
+    }
+    return true;
+}
+
+// 升级交接状态：写入memfd随fd一起发送；各记录带大小，两个版本布局不一致时拒绝交接
+#define HANDOFF_MAGIC 0x464F484Bu  // "KHOF"
+#define HANDOFF_VERSION 2   // 2: 按键记录增加release_time_ns（去抖状态）
+#define HANDOFF_MAX_FDS 64         // 状态memfd + 控制套接字 + 每个设备的输入fd与uinput fd
+#define HANDOFF_TIMEOUT_MS 2000
+#define HANDOFF_FRAME_MAX 64
+#define TAG_HANDOFF 0xFFFFFFF4u    // 交接套接字的epoll标识（与main中的其他保留标识相邻）
+
+struct HandoffHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint16_t header_size;
+    uint16_t device_size;
+    uint16_t key_size;
+    uint16_t request_size;
+    uint32_t device_count;
+    uint32_t key_count;
+    uint32_t request_count;
+    uint32_t running_actions;   // 旧进程中仍在执行的动作数（新进程代为持有动作唤醒锁直到旧进程退出）
+    uint32_t has_control_fd;
+    uint32_t reserved;
+    uint64_t dispatch_seq;
+    char profile[32];
+};
+
+struct HandoffDevice {
+    char path[128];
+    uint32_t has_ufd;
+    uint32_t frame_len;          // 重映射模式下尚未遇到SYN的半帧
+    struct input_event frame[HANDOFF_FRAME_MAX];
+};
+static_assert(sizeof(InputDevice::frame) == sizeof(HandoffDevice::frame), "frame buffer size mismatch");
+
+struct HandoffKey {
+    uint64_t press_time_ns;
+    uint64_t last_click_time_ns;
+    uint64_t click_deadline_ns;
+    uint64_t release_time_ns;    // 最近一次释放的时间，新进程据此继续去抖
+    uint32_t last_duration_ms;
+    uint16_t code;
+    int16_t device;              // 所在设备的下标，-1表示未知
+    uint8_t flags;
+    uint8_t reserved[7];
+};
+
+struct HandoffRequest {
+    char script_name[SCRIPT_NAME_MAX];
+    uint16_t keycode;
+    uint8_t serialize;
+    uint8_t reserved[5];
+    ActionContext context;
+};
+
+// 旧进程：启动新二进制（kctrl --takeover <fd> <配置>），新进程初始化完成后经交接套接字发送READY
+static void begin_upgrade() {
+    if (g_handoff_fd != -1) {
+        LOGW("Upgrade already in progress");
+        return;
+    }
+    std::string binary = g_upgrade_binary;
+    if (binary.empty()) {
+        char exe[PATH_MAX];
+        ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (n <= 0) {
+            LOGE("Upgrade: cannot resolve own executable: %s", strerror(errno));
+            return;
+        }
+        exe[n] = '\0';
+        // 可执行文件被替换后链接目标带有" (deleted)"后缀
+        if (char* deleted = strstr(exe, " (deleted)")) *deleted = '\0';
+        binary = exe;
+    }
+    
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1) {
+        LOGE("Upgrade: socketpair failed: %s", strerror(errno));
+        return;
+    }
+    // 参数在fork前准备好，子进程中只调用async-signal-safe的函数
+    char fd_arg[16];
+    snprintf(fd_arg, sizeof(fd_arg), "%d", fds[1]);
+    char takeover[] = "--takeover";
+    char* argv[] = { const_cast<char*>(g_argv0.c_str()), takeover, fd_arg,
+                     const_cast<char*>(g_config_path.c_str()), nullptr };
+    pid_t pid = fork();
+    if (pid == 0) {
+        fcntl(fds[1], F_SETFD, 0);  // 只有交接套接字与就绪通知fd跨越exec
+        if (g_ready_fd != -1) fcntl(g_ready_fd, F_SETFD, 0);
+        execv(binary.c_str(), argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid == -1) {
+        LOGE("Upgrade: fork failed: %s", strerror(errno));
+        close(fds[0]);
+        return;
+    }
+    
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = TAG_HANDOFF;
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fds[0], &ev);
+    g_handoff_fd = fds[0];
+    g_handoff_pid = pid;
+    LOGI("Upgrade: started %s (pid %d), waiting for it to become ready", binary.c_str(), pid);
+}
+
+// 旧进程：放弃本次升级，结束新进程并继续服务
+static void abort_upgrade(const char* reason) {
+    LOGE("Upgrade aborted: %s", reason);
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, g_handoff_fd, nullptr);
+    close(g_handoff_fd);
+    g_handoff_fd = -1;
+    if (g_handoff_pid > 0) {
+        kill(g_handoff_pid, SIGKILL);
+        while (waitpid(g_handoff_pid, nullptr, 0) == -1 && errno == EINTR) {}
+        g_handoff_pid = -1;
+    }
+    write_pid_file();  // 新进程可能已写入自己的PID
+}
+
+// 旧进程：新进程就绪后交出设备与状态，收到确认后返回true，此后不再处理输入
+// 等待确认期间不读取设备，到达的事件留在内核的evdev缓冲区中由新进程读取
+static bool complete_upgrade(std::vector<InputDevice>& devices, int control_fd) {
+    char buf[8];
+    ssize_t n = recv(g_handoff_fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n <= 0 || n != 5 || memcmp(buf, "READY", 5) != 0) {
+        if (n == -1 && errno == EAGAIN) return false;
+        abort_upgrade(n == 0 ? "new process exited before it was ready" : "unexpected handoff message");
+        return false;
+    }
+    
+    // 状态与fd：memfd、控制套接字、各设备的输入fd（及uinput fd）
+    std::vector<char> state(sizeof(HandoffHeader));
+    int fds[HANDOFF_MAX_FDS];
+    size_t fd_count = 1;
+    HandoffHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = HANDOFF_MAGIC;
+    header.version = HANDOFF_VERSION;
+    header.header_size = sizeof(HandoffHeader);
+    header.device_size = sizeof(HandoffDevice);
+    header.key_size = sizeof(HandoffKey);
+    header.request_size = sizeof(HandoffRequest);
+    header.dispatch_seq = g_dispatch_seq;
+    snprintf(header.profile, sizeof(header.profile), "%s", g_profile_name.c_str());
+    if (control_fd != -1) {
+        fds[fd_count++] = control_fd;
+        header.has_control_fd = 1;
+    }
+    
+    std::vector<int16_t> device_index(devices.size(), -1);
+    for (size_t i = 0; i < devices.size(); i++) {
+        const InputDevice& dev = devices[i];
+        if (dev.fd == -1) continue;
+        if (fd_count + 2 > HANDOFF_MAX_FDS) {
+            abort_upgrade("too many devices to hand off");
+            return false;
+        }
+        HandoffDevice record;
+        memset(&record, 0, sizeof(record));
+        snprintf(record.path, sizeof(record.path), "%s", dev.path.c_str());
+        record.has_ufd = dev.ufd != -1;
+        record.frame_len = static_cast<uint32_t>(dev.frame_len);
+        memcpy(record.frame, dev.frame, sizeof(record.frame));
+        fds[fd_count++] = dev.fd;
+        if (dev.ufd != -1) fds[fd_count++] = dev.ufd;
+        const char* bytes = reinterpret_cast<const char*>(&record);
+        state.insert(state.end(), bytes, bytes + sizeof(record));
+        device_index[i] = static_cast<int16_t>(header.device_count++);
+    }
+    
+    for (const auto& pair : g_gestures.states()) {
+        HandoffKey record;
+        memset(&record, 0, sizeof(record));
+        record.code = LoopGestureEngine::state_code(pair.first);
+        record.flags = pair.second.flags;
+        record.press_time_ns = pair.second.press_time_ns;
+        record.last_click_time_ns = pair.second.last_click_time_ns;
+        record.click_deadline_ns = pair.second.click_deadline_ns;
+        record.release_time_ns = pair.second.release_time_ns;
+        record.last_duration_ms = pair.second.last_duration_ms;
+        record.device = -1;
+        for (size_t i = 0; i < devices.size(); i++) {
+            if (pair.second.device == &devices[i]) record.device = device_index[i];
+        }
+        const char* bytes = reinterpret_cast<const char*>(&record);
+        state.insert(state.end(), bytes, bytes + sizeof(record));
+        header.key_count++;
+    }
+    
+    // 取出尚未执行的动作交给新进程；旧进程的唤醒锁从此只计数不写入，避免释放新进程持有的同名锁
+    std::vector<ActionRequest> pending;
+    {
+        std::lock_guard<std::mutex> lock(g_action_mutex);
+        pending.swap(g_action_queue);
+        g_action_queue.reserve(pending.capacity());
+        std::lock_guard<std::mutex> wake_lock(g_wake_mutex);
+        g_wake_detached = true;
+        header.running_actions = static_cast<uint32_t>(std::max(0, g_action_wake.refcount - static_cast<int>(pending.size())));
+    }
+    for (const auto& request : pending) {
+        HandoffRequest record;
+        memset(&record, 0, sizeof(record));
+        memcpy(record.script_name, request.script_name, sizeof(record.script_name));
+        record.keycode = request.keycode;
+        record.serialize = request.serialize;
+        record.context = request.context;
+        const char* bytes = reinterpret_cast<const char*>(&record);
+        state.insert(state.end(), bytes, bytes + sizeof(record));
+    }
+    header.request_count = static_cast<uint32_t>(pending.size());
+    memcpy(state.data(), &header, sizeof(header));
+    
+    // 失败时恢复：请求放回队列，唤醒锁恢复写入
+    auto restore = [&pending](const char* reason) {
+        {
+            std::lock_guard<std::mutex> lock(g_action_mutex);
+            g_action_queue.insert(g_action_queue.begin(), std::make_move_iterator(pending.begin()),
+                                  std::make_move_iterator(pending.end()));
+            std::lock_guard<std::mutex> wake_lock(g_wake_mutex);
+            g_wake_detached = false;
+            for (WakeSource* ws : { &g_gesture_wake, &g_action_wake }) {
+                if (ws->refcount > 0 && g_wakelock_fd != -1) write(g_wakelock_fd, ws->name, strlen(ws->name));
+            }
+        }
+        g_action_cv.notify_all();
+        abort_upgrade(reason);
+    };
+    
+    int memfd = memfd_create("kctrl_handoff", MFD_CLOEXEC);
+    if (memfd == -1 || write(memfd, state.data(), state.size()) != static_cast<ssize_t>(state.size())) {
+        if (memfd != -1) close(memfd);
+        restore("cannot write handoff state");
+        return false;
+    }
+    fds[0] = memfd;
+    
+    struct iovec iov = { const_cast<char*>("STATE"), 5 };
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    uint64_t start_ns = monotonic_ns();
+    bool sent = sendmsg(g_handoff_fd, &msg, MSG_NOSIGNAL) == 5;
+    close(memfd);
+    if (!sent) {
+        restore("cannot send handoff state");
+        return false;
+    }
+    
+    // 等待新进程注册完设备后的确认
+    struct pollfd pfd = { g_handoff_fd, POLLIN, 0 };
+    n = (poll(&pfd, 1, HANDOFF_TIMEOUT_MS) == 1) ? recv(g_handoff_fd, buf, sizeof(buf), 0) : -1;
+    if (n != 2 || memcmp(buf, "OK", 2) != 0) {
+        restore("new process did not acknowledge the handoff");
+        return false;
+    }
+    
+    for (auto& request : pending) {
+        if (request.script_fd != -1) close(request.script_fd);
+    }
+    flight_record(FR_HANDOFF, 0, g_handoff_pid, static_cast<int64_t>(monotonic_ns() - start_ns));
+    // 新进程会以自己的配置重新映射飞行记录文件，容量不同时文件会被截断，此后旧进程不再写入
+    g_flight = nullptr;
+    g_handed_off = true;
+    g_running = false;
+    LOGI("Upgrade: handed %u device(s), %u key state(s), %u pending action(s) to pid %d in %lluus",
+         header.device_count, header.key_count, header.request_count, g_handoff_pid,
+         (unsigned long long)((monotonic_ns() - start_ns) / 1000));
+    return true;
+}
+
+// 新进程：初始化完成后通知旧进程，接收设备fd、控制套接字与状态（kctrl --takeover <fd>）
+// 成功后设备、按键状态与待执行动作均已恢复，调用方注册epoll后发送确认
+static bool receive_handoff(int sock, std::vector<InputDevice>& devices, int& control_fd, uint32_t& running_actions) {
+    if (send(sock, "READY", 5, MSG_NOSIGNAL) != 5) {
+        LOGE("Takeover: cannot reach old process: %s", strerror(errno));
+        return false;
+    }
+    struct pollfd pfd = { sock, POLLIN, 0 };
+    if (poll(&pfd, 1, HANDOFF_TIMEOUT_MS) != 1) {
+        LOGE("Takeover: no state from old process");
+        return false;
+    }
+    
+    char buf[8];
+    struct iovec iov = { buf, sizeof(buf) };
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    int fds[HANDOFF_MAX_FDS];
+    size_t fd_count = 0;
+    if (n > 0) {
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (fd_count + count > HANDOFF_MAX_FDS) count = HANDOFF_MAX_FDS - fd_count;
+            memcpy(fds + fd_count, CMSG_DATA(cmsg), sizeof(int) * count);
+            fd_count += count;
+        }
+    }
+    // 失败时只关闭本进程的副本：独占与uinput设备仍由旧进程持有
+    auto fail = [&fds, &fd_count](const char* reason) {
+        LOGE("Takeover failed: %s", reason);
+        for (size_t i = 0; i < fd_count; i++) close(fds[i]);
+        return false;
+    };
+    if (n != 5 || memcmp(buf, "STATE", 5) != 0 || (msg.msg_flags & MSG_CTRUNC) || fd_count == 0) {
+        return fail("malformed handoff message");
+    }
+    
+    struct stat st;
+    if (fstat(fds[0], &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(HandoffHeader)) {
+        return fail("handoff state too small");
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fds[0], 0);
+    if (map == MAP_FAILED) return fail("cannot map handoff state");
+    const char* data = static_cast<const char*>(map);
+    HandoffHeader header;
+    memcpy(&header, data, sizeof(header));
+    size_t expected = sizeof(HandoffHeader) + header.device_count * sizeof(HandoffDevice) +
+                      header.key_count * sizeof(HandoffKey) + header.request_count * sizeof(HandoffRequest);
+    size_t expected_fds = 1 + header.has_control_fd;
+    const HandoffDevice* device_records = reinterpret_cast<const HandoffDevice*>(data + sizeof(HandoffHeader));
+    if (header.magic == HANDOFF_MAGIC && header.device_size == sizeof(HandoffDevice) &&
+        sizeof(HandoffHeader) + static_cast<size_t>(header.device_count) * sizeof(HandoffDevice) <= size) {
+        for (uint32_t i = 0; i < header.device_count; i++) expected_fds += 1 + (device_records[i].has_ufd ? 1 : 0);
+    }
+    if (header.magic != HANDOFF_MAGIC || header.version != HANDOFF_VERSION ||
+        header.header_size != sizeof(HandoffHeader) || header.device_size != sizeof(HandoffDevice) ||
+        header.key_size != sizeof(HandoffKey) || header.request_size != sizeof(HandoffRequest) ||
+        size != expected || fd_count != expected_fds) {
+        munmap(map, size);
+        return fail("incompatible handoff state (old and new versions differ too much, restart instead)");
+    }
+    
+    size_t next_fd = 1;
+    control_fd = header.has_control_fd ? fds[next_fd++] : -1;
+    devices.resize(header.device_count);
+    for (uint32_t i = 0; i < header.device_count; i++) {
+        const HandoffDevice& record = device_records[i];
+        InputDevice& dev = devices[i];
+        dev.path.assign(record.path, strnlen(record.path, sizeof(record.path)));
+        dev.fd = fds[next_fd++];
+        dev.ufd = record.has_ufd ? fds[next_fd++] : -1;
+        dev.frame_len = std::min<size_t>(record.frame_len, HANDOFF_FRAME_MAX);
+        memcpy(dev.frame, record.frame, sizeof(dev.frame));
+        dev.slot = static_cast<uint16_t>(i);
+        read_device_name(dev);
+        set_event_clock(dev);  // 时钟设置属于共享的打开文件，重设只为得到stamp_on_read
+        LOGI("Took over input device: %s%s", dev.path.c_str(), dev.ufd != -1 ? " (remap)" : "");
+    }
+    
+    const HandoffKey* keys = reinterpret_cast<const HandoffKey*>(device_records + header.device_count);
+    for (uint32_t i = 0; i < header.key_count; i++) {
+        const HandoffKey& record = keys[i];
+        if (record.code >= KEY_CNT || record.device < 0 || static_cast<uint32_t>(record.device) >= header.device_count) continue;
+        auto& state = g_gestures.states()[LoopGestureEngine::state_id(static_cast<uint16_t>(record.device), record.code)];
+        state.press_time_ns = record.press_time_ns;
+        state.last_click_time_ns = record.last_click_time_ns;
+        state.click_deadline_ns = record.click_deadline_ns;
+        state.release_time_ns = record.release_time_ns;
+        state.last_duration_ms = record.last_duration_ms;
+        state.flags = record.flags;
+        state.device = &devices[record.device];
+    }
+    
+    // 待执行的动作：脚本按名称从磁盘执行（新配置的预加载memfd与旧绑定不一定对应）
+    const HandoffRequest* requests = reinterpret_cast<const HandoffRequest*>(keys + header.key_count);
+    {
+        std::lock_guard<std::mutex> lock(g_action_mutex);
+        for (uint32_t i = 0; i < header.request_count; i++) {
+            const HandoffRequest& record = requests[i];
+            ActionRequest request;
+            memcpy(request.script_name, record.script_name, sizeof(request.script_name));
+            request.script_name[sizeof(request.script_name) - 1] = '\0';
+            request.context = record.context;
+            request.event_type = gesture_name(record.context.gesture);
+            request.keycode = record.keycode < KEY_CNT ? record.keycode : 0;
+            request.serialize = record.serialize != 0;
+            wake_source_acquire(g_action_wake);
+            g_action_queue.push_back(std::move(request));
+        }
+    }
+    g_action_cv.notify_all();
+    
+    g_dispatch_seq = header.dispatch_seq;
+    header.profile[sizeof(header.profile) - 1] = '\0';
+    if (strcmp(header.profile, g_profile_name.c_str()) != 0) switch_profile(header.profile);
+    running_actions = header.running_actions;
+    munmap(map, size);
+    close(fds[0]);
+    LOGI("Takeover: received %u device(s), %u key state(s), %u pending action(s)",
+         header.device_count, header.key_count, header.request_count);
+    return true;
+}
+
+// 输出唤醒锁统计（持有中的锁计入到当前时刻）
+static void dump_wake_source(FILE* file, const WakeSource& ws) {
+    uint64_t held_ns = ws.held_ns_total;
+    if (ws.refcount > 0) held_ns += monotonic_ns() - ws.acquired_at_ns;
+    fprintf(file, "wakelock_%s_count=%llu\n", ws.name, (unsigned long long)ws.acquire_count);
+    fprintf(file, "wakelock_%s_held_ms=%llu\n", ws.name, (unsigned long long)(held_ns / 1000000));
+    fprintf(file, "wakelock_%s_active=%d\n", ws.name, ws.refcount > 0 ? 1 : 0);
+}
+
+// 输出运行统计到统计文件（由SIGUSR1触发，退出时也会输出一次）
+static void dump_stats() {
+    FILE* file = fopen(data_path(STATS_FILE).c_str(), "w");
+    if (!file) {
+        LOGE("Failed to open stats file: %s", strerror(errno));
+        return;
+    }
+    
+    uint64_t frames = g_remap_frames.load(std::memory_order_relaxed);
+    uint64_t latency_frames = g_remap_latency_frames.load(std::memory_order_relaxed);
+    fprintf(file, "remap_enabled=%d\n", g_remap_enabled ? 1 : 0);
+    fprintf(file, "remap_frames=%llu\n", (unsigned long long)frames);
+    fprintf(file, "remap_events=%llu\n", (unsigned long long)g_remap_events.load(std::memory_order_relaxed));
+    fprintf(file, "remap_suppressed=%llu\n", (unsigned long long)g_remap_suppressed.load(std::memory_order_relaxed));
+    fprintf(file, "remap_latency_frames=%llu\n", (unsigned long long)latency_frames);
+    fprintf(file, "remap_latency_avg_us=%llu\n",
+            (unsigned long long)(latency_frames ?
+                                 g_remap_latency_ns_total.load(std::memory_order_relaxed) / latency_frames / 1000 : 0));
+    fprintf(file, "remap_latency_max_us=%llu\n",
+            (unsigned long long)(g_remap_latency_ns_max.load(std::memory_order_relaxed) / 1000));
+    
+    fprintf(file, "loop_wakeups=%llu\n", (unsigned long long)g_loop_wakeups);
+    fprintf(file, "state_watches=%zu\n", g_state_watches.size());
+    fprintf(file, "state_updates=%llu\n", (unsigned long long)g_state_updates);
+    fprintf(file, "guard_blocked=%llu\n", (unsigned long long)g_guard_blocked);
+    fprintf(file, "debounce_filtered=%llu\n", (unsigned long long)g_debounce_filtered);
+    fprintf(file, "debounce_keys=");  // 按键:抖动次数，用于找出触点磨损的按键
+    const char* separator = "";
+    for (const auto& pair : g_debounce_keys) {
+        const char* name = key_name(pair.first);
+        if (name) fprintf(file, "%s%s:%u", separator, name, pair.second);
+        else fprintf(file, "%s%u:%u", separator, pair.first, pair.second);
+        separator = ",";
+    }
+    fputc('\n', file);
+    fprintf(file, "key_states=%zu\n", g_gestures.states().size());
+    fprintf(file, "gestures=%llu\n", (unsigned long long)g_gesture_count);
+    fprintf(file, "gesture_latency_total_us=%llu\n", (unsigned long long)(g_gesture_latency_ns_total / 1000));
+    fprintf(file, "gesture_latency_max_us=%llu\n", (unsigned long long)(g_gesture_latency_ns_max / 1000));
+    {
+        std::lock_guard<std::mutex> lock(g_action_mutex);
+        fprintf(file, "action_queue_depth=%zu\n", g_action_queue.size());
+        fprintf(file, "action_queue_peak=%zu\n", g_action_queue_peak);
+        fprintf(file, "action_queue_max=%zu\n", g_action_queue_max.load(std::memory_order_relaxed));
+        fprintf(file, "action_enqueued=%llu\n", (unsigned long long)g_action_enqueued);
+        fprintf(file, "action_dropped=%llu\n", (unsigned long long)g_action_dropped);
+        fprintf(file, "action_evicted=%llu\n", (unsigned long long)g_action_evicted);
+        fprintf(file, "action_coalesced=%llu\n", (unsigned long long)g_action_coalesced);
+        fprintf(file, "action_started=%llu\n", (unsigned long long)g_action_started);
+        fprintf(file, "action_wait_total_us=%llu\n", (unsigned long long)(g_action_wait_ns_total / 1000));
+        fprintf(file, "action_wait_max_us=%llu\n", (unsigned long long)(g_action_wait_ns_max / 1000));
+    }
+    fprintf(file, "action_rate_limited=%llu\n", (unsigned long long)g_action_rate_limited);
+    fprintf(file, "config_arena_kb=%zu\n", g_cfg ? g_cfg->arena.reserved / 1024 : 0);
+    fprintf(file, "profile=%s\n", g_profile ? g_profile->name.data() : "none");
+    fprintf(file, "profile_switches=%llu\n", (unsigned long long)g_profile_switches);
+    {
+        std::lock_guard<std::mutex> lock(g_wake_mutex);
+        dump_wake_source(file, g_gesture_wake);
+        dump_wake_source(file, g_action_wake);
+    }
+    fclose(file);
+}
+
+// 清理函数
+void cleanup() {
+    g_running = false;
+    stop_action_workers();
+    
+    // 关闭状态监视
+    for (auto& watch : g_state_watches) {
+        if (watch.fd != -1) close(watch.fd);
+    }
+    g_state_watches.clear();
+    
+    // 清理按键状态
+    g_gestures.states().clear();
+    if (g_timer_fd != -1) {
+        close(g_timer_fd);
+        g_timer_fd = -1;
+    }
+    
+    // 恢复系统资源设置
+    munlockall(); // 解锁内存，允许使用swap
+    
+    // 恢复CPU亲和性到所有核心
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int i = 0; i < sysconf(_SC_NPROCESSORS_ONLN); i++) {
+        CPU_SET(i, &cpu_set);
+    }
+    sched_setaffinity(0, sizeof(cpu_set), &cpu_set);
+    
+    dump_stats();
+    release_wakelock();
+    flight_close();
+    if (g_trace_fd != -1) {
+        int fd = g_trace_fd;
+        g_trace_fd = -1;
+        close(fd);
+    }
+    if (!g_handed_off) unlink(data_path(PID_FILE).c_str());  // 交接后PID文件已属于新进程
+    LOGI("Cleanup completed with system resources restored");
+}
+
+// 飞行记录解码：按序输出最近seconds秒（以最新一条记录为准）的记录
+static const char* flight_type_name(uint8_t type) {
+    switch (type) {
+        case FR_START: return "START";
+        case FR_EVENT: return "EVENT";
+        case FR_CLASSIFY: return "CLASSIFY";
+        case FR_TIMER_ARM: return "TIMER_ARM";
+        case FR_TIMER_FIRE: return "TIMER_FIRE";
+        case FR_DISPATCH: return "DISPATCH";
+        case FR_SPAWN: return "SPAWN";
+        case FR_EXIT: return "EXIT";
+        case FR_RELOAD: return "RELOAD";
+        case FR_PROFILE: return "PROFILE";
+        case FR_DROP: return "DROP";
+        case FR_HANDOFF: return "HANDOFF";
+        case FR_DEBOUNCE: return "DEBOUNCE";
+        default: return "UNKNOWN";
+    }
+}
+
+static const char* drop_reason_name(int32_t reason) {
+    switch (reason) {
+        case DROP_QUEUE_FULL: return "queue_full";
+        case DROP_EVICTED: return "evicted";
+        case DROP_COALESCED: return "coalesced";
+        case DROP_RATE_LIMITED: return "rate_limited";
+        default: return "unknown";
+    }
+}
+
+static int flight_dump(const char* path, double seconds) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(FlightHeader)) {
+        fprintf(stderr, "Invalid flight recorder file: %s\n", path);
+        close(fd);
+        return 1;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    
+    const auto* header = static_cast<const FlightHeader*>(map);
+    if (header->magic != FLIGHT_MAGIC || header->version != FLIGHT_VERSION ||
+        header->record_size != sizeof(FlightRecord) ||
+        sizeof(FlightHeader) + static_cast<size_t>(header->capacity) * sizeof(FlightRecord) > static_cast<size_t>(st.st_size)) {
+        fprintf(stderr, "Unsupported flight recorder format: %s\n", path);
+        munmap(map, st.st_size);
+        return 1;
+    }
+    const auto* records = reinterpret_cast<const FlightRecord*>(static_cast<const char*>(map) + sizeof(FlightHeader));
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    uint64_t capacity = header->capacity;
+    uint64_t first = head > capacity ? head - capacity : 0;
+    
+    // 收集序号有效的记录（环形缓冲中按槽位序号排列即为写入顺序）
+    std::vector<FlightRecord> valid;
+    valid.reserve(head - first);
+    for (uint64_t slot = first; slot < head; slot++) {
+        FlightRecord r = records[slot % capacity];
+        if (r.seq == static_cast<uint32_t>(slot + 1)) valid.push_back(r);
+    }
+    munmap(map, st.st_size);
+    if (valid.empty()) {
+        printf("Flight recorder is empty\n");
+        return 0;
+    }
+    
+    // 使用最近的START记录把单调时间换算为墙上时间；窗口以最新记录为终点
+    int64_t offset_ns = 0;
+    uint64_t newest_ns = 0;
+    for (const auto& r : valid) {
+        if (r.time_ns > newest_ns) newest_ns = r.time_ns;
+    }
+    uint64_t window_ns = static_cast<uint64_t>(seconds * 1e9);
+    uint64_t since_ns = newest_ns > window_ns ? newest_ns - window_ns : 0;
+    
+    // START记录已被覆盖时无法换算墙上时间，只输出单调时间
+    bool has_offset = false;
+    for (const auto& r : valid) {
+        if (r.type == FR_START) {
+            offset_ns = r.arg - static_cast<int64_t>(r.time_ns);
+            has_offset = true;
+        }
+        if (r.time_ns < since_ns && r.type != FR_START) continue;
+        
+        if (has_offset) {
+            time_t wall_sec = static_cast<time_t>((static_cast<int64_t>(r.time_ns) + offset_ns) / 1000000000LL);
+            long wall_ms = static_cast<long>(((static_cast<int64_t>(r.time_ns) + offset_ns) / 1000000LL) % 1000);
+            struct tm tm_info;
+            localtime_r(&wall_sec, &tm_info);
+            printf("%02d:%02d:%02d.%03ld", tm_info.tm_hour, tm_info.tm_min, tm_info.tm_sec, wall_ms);
+        } else {
+            printf("--:--:--.---");
+        }
+        printf(" %12.6f %-10s", r.time_ns / 1e9, flight_type_name(r.type));
+        switch (r.type) {
+            case FR_START: printf(" pid=%d\n", r.value); break;
+            case FR_EVENT: printf(" code=%u value=%d lag_us=%lld\n", r.code, r.value, (long long)(r.arg / 1000)); break;
+            case FR_CLASSIFY: printf(" code=%u %s duration_ms=%lld\n", r.code, gesture_name(r.value), (long long)r.arg); break;
+            case FR_TIMER_ARM: printf(" deadline=%.6f\n", r.arg / 1e9); break;
+            case FR_TIMER_FIRE: printf(" code=%u clicks=%d\n", r.code, r.value); break;
+            case FR_DISPATCH: printf(" code=%u %s %s\n", r.code, gesture_name(r.value),
+                                     r.arg == DISPATCH_BOUND ? "bound" : r.arg == DISPATCH_GUARDED ? "guarded" : "unbound"); break;
+            case FR_SPAWN: printf(" pid=%d\n", r.value); break;
+            case FR_EXIT: printf(" pid=%d status=%lld\n", r.value, (long long)r.arg); break;
+            case FR_RELOAD: printf(" %s\n", r.value ? "ok" : "failed"); break;
+            case FR_PROFILE: printf(" profile=%d from=%lld\n", r.value, (long long)r.arg); break;
+            case FR_DROP: printf(" code=%u %s\n", r.code, drop_reason_name(r.value)); break;
+            case FR_HANDOFF: printf(" pid=%d took_us=%lld\n", r.value, (long long)(r.arg / 1000)); break;
+            case FR_DEBOUNCE: printf(" code=%u %s gap_us=%lld\n", r.code, r.value ? "merged" : "dropped",
+                                     (long long)(r.arg / 1000)); break;
+            default: printf(" code=%u value=%d arg=%lld\n", r.code, r.value, (long long)r.arg); break;
+        }
+    }
+    return 0;
+}
+
+// 配置解析基准：生成含N条绑定（带行内注释与超长注释行）的配置，测量编译耗时与分发查表耗时
+static int bench_config(int bindings) {
+    static const char* suffixes[GESTURE_TYPE_COUNT] = { "click", "double_click", "short_press", "long_press" };
+    int fd = memfd_create("kctrl_bench_config", MFD_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "memfd_create failed: %s\n", strerror(errno));
+        return 1;
+    }
+    
+    FILE* out = fdopen(dup(fd), "w");
+    if (!out) {
+        close(fd);
+        return 1;
+    }
+    fprintf(out, "# kctrl bench config\ndevice=/dev/input/event0\nclick_threshold=200\n");
+    fprintf(out, "# %s\n", std::string(8192, '-').c_str());  // 超出旧解析器行缓冲区的注释行
+    for (int i = 0; i < bindings; i++) {
+        int keycode = 1 + i % (KEY_CNT - 1);
+        const char* suffix = suffixes[(i / (KEY_CNT - 1)) % GESTURE_TYPE_COUNT];
+        fprintf(out, "script_%d_%s=key%d_%s.sh    # binding %d\n", keycode, suffix, keycode, suffix, i);
+        if (i % 16 == 0) fprintf(out, "remap_%d=%d\n", keycode, keycode);
+    }
+    // 覆盖部分绑定的配置方案，用于测量方案切换
+    fprintf(out, "[bench]\n");
+    for (int i = 0; i < bindings / 10; i++) {
+        int keycode = 1 + i % (KEY_CNT - 1);
+        fprintf(out, "script_%d_click=bench%d.sh\n", keycode, keycode);
+    }
+    fclose(out);
+    
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    struct stat st;
+    fstat(fd, &st);
+    
+    const int iterations = 20;
+    uint64_t total_ns = 0, best_ns = UINT64_MAX;
+    CompiledConfig* cfg = nullptr;
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = monotonic_ns();
+        CompiledConfig* next = compile_config_file(path, false);
+        uint64_t elapsed = monotonic_ns() - start;
+        if (!next) {
+            fprintf(stderr, "Failed to compile %s\n", path);
+            close(fd);
+            destroy_config(cfg);
+            return 1;
+        }
+        total_ns += elapsed;
+        if (elapsed < best_ns) best_ns = elapsed;
+        destroy_config(cfg);
+        cfg = next;
+    }
+    close(fd);
+    
+    // 模拟分发查表：按键码 -> 绑定行 -> 手势
+    const ProfileTable* table = &cfg->profiles[DEFAULT_PROFILE];
+    const int lookups = 1000000;
+    size_t hits = 0;
+    uint64_t start = monotonic_ns();
+    for (int i = 0; i < lookups; i++) {
+        int keycode = i % KEY_CNT;
+        uint16_t index = table->key_index[keycode];
+        if (index != NO_BINDING && table->bindings[index].actions[i & 3]) hits++;
+    }
+    uint64_t lookup_ns = monotonic_ns() - start;
+    
+    // 方案切换：只替换分发表指针
+    g_cfg = cfg;
+    g_profile = table;
+    const int switches = 100000;
+    start = monotonic_ns();
+    for (int i = 0; i < switches; i++) switch_profile((i & 1) ? "default" : "bench");
+    uint64_t switch_ns = monotonic_ns() - start;
+    g_cfg = nullptr;
+    g_profile = nullptr;
+    
+    printf("config: %d binding line(s), %lld bytes\n", bindings, (long long)st.st_size);
+    printf("compiled: %zu setting(s), %zu binding(s) on %zu key(s) in %zu profile(s), arena %zuKB\n",
+           cfg->settings_count, cfg->action_count, table->binding_count, cfg->profile_count,
+           cfg->arena.reserved / 1024);
+    printf("compile: avg %.3fms, min %.3fms over %d run(s)\n",
+           total_ns / 1e6 / iterations, best_ns / 1e6, iterations);
+    printf("lookup: %.1fns/dispatch (%zu hit(s) in %d)\n", (double)lookup_ns / lookups, hits, lookups);
+    printf("profile switch: %.1fns\n", (double)switch_ns / switches);
+    destroy_config(cfg);
+    return 0;
+}
+
+// 手势引擎基准：引擎以虚拟时钟、虚拟定时器与记录分发实例化，不访问设备、timerfd与全局状态，
+// 多个设备交错回放确定的按键序列，测量每个事件的识别耗时并核对识别结果
+struct BenchDevice {
+    uint16_t slot;
+};
+struct VirtualClock {
+    uint64_t now;
+    uint64_t now_ns() { return now; }
+};
+struct VirtualTimer {
+    uint64_t deadline;
+    void arm(uint64_t deadline_ns) { deadline = deadline_ns; }
+};
+struct RecordingDispatcher {
+    GestureTiming config;
+    uint64_t gestures[GESTURE_TYPE_COUNT];
+    uint64_t bounces;
+    uint64_t checksum;
+    
+    GestureTiming timing(const BenchDevice&, uint16_t) { return config; }
+    void dispatch(uint16_t code, GestureId gesture, uint32_t duration_ms, uint8_t clicks,
+                  uint64_t time_ns, uint64_t, const BenchDevice* device) {
+        gestures[gesture]++;
+        checksum = checksum * 31 + (time_ns ^ duration_ms ^ (static_cast<uint64_t>(clicks) << 32) ^
+                                    (static_cast<uint64_t>(code) << 40) ^ (static_cast<uint64_t>(device->slot) << 56));
+    }
+    void pressed(uint16_t) {}
+    void classified(uint16_t, int32_t, uint32_t, uint64_t) {}
+    void timer_fired(uint16_t, uint8_t) {}
+    void bounced(uint16_t, bool, uint64_t, uint64_t) { bounces++; }
+    void busy(bool) {}
+};
+
+static int bench_gesture(long events) {
+    // 每个设备每周期：单击、双击、短按、长按、带两次抖动的单击（毫秒偏移，1按下/0释放）
+    static const struct { uint16_t offset_ms; int32_t value; } pattern[] = {
+        { 0, 1 }, { 80, 0 },                                  // 单击
+        { 580, 1 }, { 660, 0 }, { 760, 1 }, { 840, 0 },      // 双击
+        { 1340, 1 }, { 1740, 0 },                            // 短按
+        { 2240, 1 }, { 3440, 0 },                            // 长按
+        { 3940, 1 }, { 3943, 0 }, { 3945, 1 }, { 4030, 0 }, { 4033, 1 }, { 4035, 0 },  // 抖动的单击
+    };
+    const size_t pattern_len = sizeof(pattern) / sizeof(pattern[0]);
+    const uint64_t cycle_ns = 5000ULL * 1000000ULL;
+    const int device_count = 4;
+    const uint64_t device_shift_ns = 7ULL * 1000000ULL;  // 各设备错开7ms，事件交错到达
+    const uint16_t code = KEY_POWER;
+    
+    BenchDevice devices[device_count];
+    for (int i = 0; i < device_count; i++) devices[i].slot = static_cast<uint16_t>(i);
+    
+    // 一个周期内全部设备的事件按时间排序，回放时逐周期平移
+    struct BenchEvent { uint64_t offset_ns; int device; int32_t value; };
+    std::vector<BenchEvent> cycle;
+    for (int i = 0; i < device_count; i++) {
+        for (size_t j = 0; j < pattern_len; j++) {
+            cycle.push_back({ pattern[j].offset_ms * 1000000ULL + i * device_shift_ns, i, pattern[j].value });
+        }
+    }
+    std::stable_sort(cycle.begin(), cycle.end(),
+                     [](const BenchEvent& a, const BenchEvent& b) { return a.offset_ns < b.offset_ns; });
+    long cycles = events / static_cast<long>(cycle.size());
+    if (cycles < 1) cycles = 1;
+    
+    RecordingDispatcher recorder;
+    memset(&recorder, 0, sizeof(recorder));
+    recorder.config = { 200, 1000, 300, 10 };
+    GestureEngine<BenchDevice, VirtualClock, VirtualTimer, RecordingDispatcher> engine(
+        VirtualClock{ 0 }, VirtualTimer{ 0 }, recorder);
+    engine.states().reserve(device_count);
+    
+    uint64_t base_ns = 1000000000ULL;
+    uint64_t start = monotonic_ns();
+    for (long c = 0; c < cycles; c++, base_ns += cycle_ns) {
+        for (const BenchEvent& e : cycle) {
+            uint64_t event_ns = base_ns + e.offset_ns;
+            // 事件之前到期的双击窗口先触发，与事件循环中timerfd先于输入就绪的顺序一致
+            while (engine.timer().deadline != 0 && engine.timer().deadline <= event_ns) {
+                engine.clock().now = engine.timer().deadline;
+                engine.timer_expired();
+            }
+            engine.key_event(devices[e.device], code, e.value, event_ns);
+        }
+    }
+    while (engine.timer().deadline != 0) {
+        engine.clock().now = engine.timer().deadline;
+        engine.timer_expired();
+    }
+    uint64_t elapsed_ns = monotonic_ns() - start;
+    
+    const RecordingDispatcher& result = engine.dispatcher();
+    uint64_t total = static_cast<uint64_t>(cycles) * cycle.size();
+    uint64_t per_device = static_cast<uint64_t>(cycles) * device_count;
+    const uint64_t expected[GESTURE_TYPE_COUNT] = { 2 * per_device, per_device, per_device, per_device };
+    bool pass = result.bounces == 2 * per_device;
+    printf("events: %llu on %d device(s), %.1fns/event\n", (unsigned long long)total, device_count,
+           (double)elapsed_ns / total);
+    for (int g = 0; g < GESTURE_TYPE_COUNT; g++) {
+        printf("%s: %llu (expected %llu)\n", gesture_name(g), (unsigned long long)result.gestures[g],
+               (unsigned long long)expected[g]);
+        if (result.gestures[g] != expected[g]) pass = false;
+    }
+    printf("bounces: %llu (expected %llu)\n", (unsigned long long)result.bounces, (unsigned long long)(2 * per_device));
+    printf("checksum: %016llx, key states: %zu\n", (unsigned long long)result.checksum, engine.states().size());
+    printf("bench-gesture: %s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+// 空闲开销报告：在指定时间内只读取/proc，不与目标进程交互，比较前后的上下文切换、CPU时间与内存
+struct TaskSample {
+    int tid;
+    char comm[32];
+    uint64_t voluntary;      // 自愿上下文切换（阻塞后被唤醒）
+    uint64_t nonvoluntary;
+    uint64_t cpu_ticks;      // utime + stime
+};
+
+struct ProcessSample {
+    std::vector<TaskSample> tasks;
+    long rss_kb;
+    long hwm_kb;
+    int fd_count;
+};
+
+// 读取/proc/<pid>/status中的数值字段
+static long read_status_field(const char* path, const char* field) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+    char line[256];
+    long value = -1;
+    size_t len = strlen(field);
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            value = atol(line + len + 1);
+            break;
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+static bool sample_process(int pid, ProcessSample& sample) {
+    char path[128];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    sample.rss_kb = read_status_field(path, "VmRSS");
+    sample.hwm_kb = read_status_field(path, "VmHWM");
+    if (sample.rss_kb < 0) return false;
+    
+    sample.fd_count = 0;
+    snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+    if (DIR* dir = opendir(path)) {
+        while (struct dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') sample.fd_count++;
+        }
+        closedir(dir);
+    }
+    
+    sample.tasks.clear();
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR* dir = opendir(path);
+    if (!dir) return false;
+    while (struct dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') continue;
+        TaskSample task;
+        memset(&task, 0, sizeof(task));
+        task.tid = atoi(entry->d_name);
+        
+        char task_path[160];
+        snprintf(task_path, sizeof(task_path), "/proc/%d/task/%d/status", pid, task.tid);
+        long voluntary = read_status_field(task_path, "voluntary_ctxt_switches");
+        long nonvoluntary = read_status_field(task_path, "nonvoluntary_ctxt_switches");
+        if (voluntary < 0) continue;  // 线程已退出
+        task.voluntary = static_cast<uint64_t>(voluntary);
+        task.nonvoluntary = static_cast<uint64_t>(nonvoluntary < 0 ? 0 : nonvoluntary);
+        
+        // stat第2字段为(comm)，之后第12、13个字段为utime、stime
+        snprintf(task_path, sizeof(task_path), "/proc/%d/task/%d/stat", pid, task.tid);
+        if (FILE* file = fopen(task_path, "r")) {
+            char buf[512];
+            size_t n = fread(buf, 1, sizeof(buf) - 1, file);
+            fclose(file);
+            buf[n] = '\0';
+            char* open_paren = strchr(buf, '(');
+            char* close_paren = strrchr(buf, ')');
+            if (open_paren && close_paren && close_paren > open_paren) {
+                snprintf(task.comm, sizeof(task.comm), "%.*s", (int)(close_paren - open_paren - 1), open_paren + 1);
+                unsigned long long utime = 0, stime = 0;
+                sscanf(close_paren + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime);
+                task.cpu_ticks = utime + stime;
+            }
+        }
+        sample.tasks.push_back(task);
+    }
+    closedir(dir);
+    return true;
+}
+
+// kctrl --idle-report [秒数] [pid]：无输入时应没有任何唤醒与CPU时间，否则以2退出
+static int idle_report(double seconds, int pid) {
+    if (pid <= 0) pid = read_pid_file();
+    ProcessSample before, after;
+    if (pid <= 0 || !sample_process(pid, before)) {
+        fprintf(stderr, "Cannot read process %d (pass a pid or start kctrl first)\n", pid);
+        return 1;
+    }
+    
+    printf("Sampling pid %d for %.0fs, keep the device idle...\n", pid, seconds);
+    fflush(stdout);
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(seconds);
+    ts.tv_nsec = static_cast<long>((seconds - ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+    
+    if (!sample_process(pid, after)) {
+        fprintf(stderr, "Process %d exited during sampling\n", pid);
+        return 1;
+    }
+    
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    uint64_t total_switches = 0, total_ticks = 0;
+    printf("\n%-8s %-16s %10s %10s %10s\n", "TID", "THREAD", "WAKEUPS", "PREEMPT", "CPU_MS");
+    for (const auto& task : after.tasks) {
+        const TaskSample* prev = nullptr;
+        for (const auto& old : before.tasks) {
+            if (old.tid == task.tid) prev = &old;
+        }
+        uint64_t voluntary = task.voluntary - (prev ? prev->voluntary : 0);
+        uint64_t nonvoluntary = task.nonvoluntary - (prev ? prev->nonvoluntary : 0);
+        uint64_t ticks = task.cpu_ticks - (prev ? prev->cpu_ticks : 0);
+        total_switches += voluntary + nonvoluntary;
+        total_ticks += ticks;
+        printf("%-8d %-16s %10llu %10llu %10llu%s\n", task.tid, task.comm, (unsigned long long)voluntary,
+               (unsigned long long)nonvoluntary, (unsigned long long)(ticks * 1000 / ticks_per_sec),
+               prev ? "" : "  (new)");
+    }
+    for (const auto& old : before.tasks) {
+        bool alive = false;
+        for (const auto& task : after.tasks) {
+            if (task.tid == old.tid) alive = true;
+        }
+        if (!alive) printf("%-8d %-16s %10s\n", old.tid, old.comm, "(exited)");
+    }
+    
+    printf("\nthreads: %zu -> %zu\n", before.tasks.size(), after.tasks.size());
+    printf("fds: %d -> %d\n", before.fd_count, after.fd_count);
+    printf("rss: %ldKB -> %ldKB (drift %+ldKB), peak %ldKB\n", before.rss_kb, after.rss_kb,
+           after.rss_kb - before.rss_kb, after.hwm_kb);
+    printf("wakeups/min: %.2f, cpu: %llums\n", total_switches * 60.0 / seconds,
+           (unsigned long long)(total_ticks * 1000 / ticks_per_sec));
+    
+    bool idle = total_switches == 0 && total_ticks == 0 && after.tasks.size() == before.tasks.size() &&
+                after.rss_kb <= before.rss_kb;
+    printf("idle: %s\n", idle ? "PASS" : "FAIL");
+    return idle ? 0 : 2;
+}
+
+// 内存统计：按子系统汇总/proc/<pid>/smaps
+enum MemSubsystem {
+    MEM_CODE,       // kctrl可执行文件
+    MEM_LIBS,       // 共享库
+    MEM_HEAP,       // malloc堆
+    MEM_CONFIG,     // 配置arena（[anon:kctrl:config]）
+    MEM_FLIGHT,     // 飞行记录器（kflight.bin）
+    MEM_STACKS,     // 主线程与其他线程的栈
+    MEM_OTHER,      // 其他匿名映射与文件
+    MEM_SUBSYSTEM_COUNT
+};
+
+static const char* mem_subsystem_name(int subsystem) {
+    switch (subsystem) {
+        case MEM_CODE: return "code";
+        case MEM_LIBS: return "libs";
+        case MEM_HEAP: return "heap";
+        case MEM_CONFIG: return "config";
+        case MEM_FLIGHT: return "flight";
+        case MEM_STACKS: return "stacks";
+        default: return "other";
+    }
+}
+
+static int classify_mapping(const char* name, const char* exe) {
+    if (strstr(name, "[anon:" ARENA_VMA_NAME "]")) return MEM_CONFIG;
+    if (strstr(name, "kflight.bin")) return MEM_FLIGHT;
+    if (strcmp(name, "[heap]") == 0 || strstr(name, "[anon:libc_malloc") || strstr(name, "[anon:scudo:") ||
+        strstr(name, "[anon:GWP-ASan")) {
+        return MEM_HEAP;
+    }
+    if (strcmp(name, "[stack]") == 0 || strstr(name, "[anon:stack_and_tls:") || strstr(name, "[anon:thread")) {
+        return MEM_STACKS;
+    }
+    if (exe[0] && strcmp(name, exe) == 0) return MEM_CODE;
+    if (strstr(name, ".so")) return MEM_LIBS;
+    return MEM_OTHER;
+}
+
+// kctrl --memstats [pid] [预算KB]：预算缺省取配置中的memory_budget_kb，RSS超出预算时以3退出
+static int memstats_report(int pid, long budget_kb) {
+    if (pid <= 0) pid = read_pid_file();
+    if (budget_kb < 0) {
+        CompiledConfig* cfg = compile_config_file(g_config_path.c_str(), false);
+        budget_kb = cfg ? sv_to_int(config_get(cfg, "memory_budget_kb"), 0) : 0;
+        destroy_config(cfg);
+    }
+    
+    char path[64];
+    char exe[PATH_MAX] = "";
+    snprintf(path, sizeof(path), "/proc/%d/exe", pid);
+    ssize_t exe_len = readlink(path, exe, sizeof(exe) - 1);
+    exe[exe_len > 0 ? exe_len : 0] = '\0';
+    snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+    FILE* file = (pid > 0) ? fopen(path, "r") : nullptr;
+    if (!file) {
+        fprintf(stderr, "Cannot read %s (pass a pid or start kctrl first)\n", path);
+        return 1;
+    }
+    
+    struct Usage {
+        long rss_kb, pss_kb, private_dirty_kb, swap_kb;
+        int mappings;
+    };
+    Usage usage[MEM_SUBSYSTEM_COUNT];
+    memset(usage, 0, sizeof(usage));
+    int current = MEM_OTHER;
+    char line[PATH_MAX + 128];
+    while (fgets(line, sizeof(line), file)) {
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n') line[len - 1] = '\0';
+        
+        // 映射头：地址范围 权限 偏移 设备 inode [名称]
+        unsigned long start, end;
+        int name_offset = 0;
+        if (sscanf(line, "%lx-%lx %*s %*s %*s %*s %n", &start, &end, &name_offset) == 2 && name_offset > 0) {
+            current = classify_mapping(line + name_offset, exe);
+            usage[current].mappings++;
+            continue;
+        }
+        long value;
+        if (sscanf(line, "Rss: %ld kB", &value) == 1) usage[current].rss_kb += value;
+        else if (sscanf(line, "Pss: %ld kB", &value) == 1) usage[current].pss_kb += value;
+        else if (sscanf(line, "Private_Dirty: %ld kB", &value) == 1) usage[current].private_dirty_kb += value;
+        else if (sscanf(line, "Swap: %ld kB", &value) == 1) usage[current].swap_kb += value;
+    }
+    fclose(file);
+    
+    Usage total;
+    memset(&total, 0, sizeof(total));
+    printf("%-8s %8s %8s %8s %8s %6s\n", "SUBSYS", "RSS_KB", "PSS_KB", "DIRTY_KB", "SWAP_KB", "VMAS");
+    for (int i = 0; i < MEM_SUBSYSTEM_COUNT; i++) {
+        const Usage& u = usage[i];
+        printf("%-8s %8ld %8ld %8ld %8ld %6d\n", mem_subsystem_name(i), u.rss_kb, u.pss_kb,
+               u.private_dirty_kb, u.swap_kb, u.mappings);
+        total.rss_kb += u.rss_kb;
+        total.pss_kb += u.pss_kb;
+        total.private_dirty_kb += u.private_dirty_kb;
+        total.swap_kb += u.swap_kb;
+        total.mappings += u.mappings;
+    }
+    printf("%-8s %8ld %8ld %8ld %8ld %6d\n", "total", total.rss_kb, total.pss_kb,
+           total.private_dirty_kb, total.swap_kb, total.mappings);
+    
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    printf("threads: %ld\n", read_status_field(path, "Threads"));
+    
+    if (budget_kb > 0) {
+        bool ok = total.rss_kb <= budget_kb;
+        printf("budget: %ldKB rss / %ldKB budget: %s\n", total.rss_kb, budget_kb, ok ? "PASS" : "FAIL");
+        return ok ? 0 : 3;
+    }
+    return 0;
+}
+
+// 压力/浸泡测试：kctrl --stress [秒数] [设备数] [每设备每秒手势数] [手势比例]
+// 创建若干uinput设备，以独立的配置与临时数据目录启动一个kctrl子进程监听它们，按比例持续注入点击/双击/短按/长按，
+// 周期性采样子进程的线程数、fd数、RSS以及统计文件中的按键状态数、队列深度与延迟，
+// 结束时比较前后两半的采样，任何一项持续增长即判定为泄漏并以4退出
+#define STRESS_DIR "kstress.XXXXXX"  // 被测实例的数据目录，建在数据目录下，结束后删除
+#define STRESS_CONFIG "kstress.conf"
+#define STRESS_SCRIPT "kstress.sh"
+#define STRESS_KEYS_PER_DEVICE 3
+#define STRESS_MAX_DEVICES 10     // 每个设备使用3个互不重叠的KEY_MACRO按键，共30个
+#define STRESS_CLICK_MS 80        // 注入配置中的阈值，缩短后单位时间内可完成更多手势
+#define STRESS_LONG_MS 400
+#define STRESS_DOUBLE_MS 150
+
+static volatile sig_atomic_t g_stress_stop = 0;
+
+struct StressDevice {
+    int fd;
+    uint16_t key;         // 当前手势使用的按键
+    uint8_t gesture;
+    uint8_t step;         // 当前手势已注入的按下/释放次数
+    uint64_t next_ns;     // 下一次注入的时间
+    uint64_t start_ns;    // 当前手势开始的时间
+};
+
+// 采样指标；延迟为采样区间内的平均值
+enum StressMetric {
+    STRESS_THREADS,
+    STRESS_FDS,
+    STRESS_KEY_STATES,
+    STRESS_RSS_KB,
+    STRESS_QUEUE_DEPTH,
+    STRESS_GESTURE_LATENCY_US,
+    STRESS_ACTION_WAIT_US,
+    STRESS_METRIC_COUNT
+};
+
+// 增长判定：exact为应保持不变的量，后一半最大值超过前一半最大值即为增长；
+// 其余比较均值，超过 前一半均值*(1+ratio)+slack 且后一半最小值高于前一半最大值才算持续增长
+static const struct { const char* name; bool exact; double ratio; double slack; } g_stress_checks[STRESS_METRIC_COUNT] = {
+    { "threads", true, 0, 0 },
+    { "fds", true, 0, 0 },
+    { "key_states", true, 0, 0 },
+    { "rss", false, 0.05, 256 },
+    { "queue_depth", false, 0, 2 },
+    { "gesture_latency", false, 0.5, 1000 },
+    { "action_wait", false, 0.5, 1000 },
+};
+
+struct StressSample {
+    double t;
+    double values[STRESS_METRIC_COUNT];
+};
+
+// 每种手势的按下/释放间隔：偶数步为按下，奇数步为释放，delays[i]为第i步距上一步的毫秒数
+static const struct { uint8_t steps; uint16_t delays[4]; } g_stress_plans[GESTURE_TYPE_COUNT] = {
+    { 2, { 0, 30, 0, 0 } },                              // 单击
+    { 4, { 0, 30, 60, 30 } },                            // 双击
+    { 2, { 0, (STRESS_CLICK_MS + STRESS_LONG_MS) / 2, 0, 0 } },  // 短按
+    { 2, { 0, STRESS_LONG_MS + 100, 0, 0 } },            // 长按
+};
+
+static void stress_signal(int) { g_stress_stop = 1; }
+
+static uint64_t stress_random(uint64_t& seed) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static int create_stress_device(int index) {
+    int ufd = open("/dev/uinput", O_WRONLY | O_CLOEXEC);
+    if (ufd == -1) return -1;
+    ioctl(ufd, UI_SET_EVBIT, EV_KEY);
+    for (int i = 0; i < STRESS_KEYS_PER_DEVICE; i++) {
+        ioctl(ufd, UI_SET_KEYBIT, KEY_MACRO1 + index * STRESS_KEYS_PER_DEVICE + i);
+    }
+    struct uinput_setup setup;
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    snprintf(setup.name, sizeof(setup.name), "kctrl-stress-%d", index);
+    if (ioctl(ufd, UI_DEV_SETUP, &setup) == -1 || ioctl(ufd, UI_DEV_CREATE) == -1) {
+        close(ufd);
+        return -1;
+    }
+    return ufd;
+}
+
+static bool stress_emit(int fd, uint16_t code, int value) {
+    struct input_event events[2];
+    memset(events, 0, sizeof(events));
+    events[0].type = EV_KEY;
+    events[0].code = code;
+    events[0].value = value;
+    events[1].type = EV_SYN;
+    events[1].code = SYN_REPORT;
+    return write(fd, events, sizeof(events)) == static_cast<ssize_t>(sizeof(events));
+}
+
+// 在被测实例的数据目录中写出配置与脚本：只监听压力设备，每个按键的四种手势都绑定到空脚本
+static bool write_stress_config(const std::string& dir, int devices) {
+    std::string config = dir + "/" STRESS_CONFIG;
+    FILE* file = fopen(config.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "device=kctrl-stress-*\n");
+    fprintf(file, "click_threshold=%d\nlong_press_threshold=%d\n", STRESS_CLICK_MS, STRESS_LONG_MS);
+    fprintf(file, "double_click_interval=%d\nenable_log=0\naction_threads=2\naction_queue_max=16\n",
+            STRESS_DOUBLE_MS);
+    for (int key = 0; key < devices * STRESS_KEYS_PER_DEVICE; key++) {
+        for (int gesture = 0; gesture < GESTURE_TYPE_COUNT; gesture++) {
+            fprintf(file, "script_%d_%s=%s\n", KEY_MACRO1 + key,
+                    gesture_name(gesture), STRESS_SCRIPT);
+        }
+    }
+    fclose(file);
+    
+    std::string scripts = dir + "/" SCRIPTS_DIR;
+    if (mkdir(scripts.c_str(), 0755) == -1) return false;
+    file = fopen((scripts + "/" STRESS_SCRIPT).c_str(), "w");
+    if (!file) return false;
+    fputs("#!/system/bin/sh\nexit 0\n", file);
+    fclose(file);
+    return true;
+}
+
+// 请求被测实例输出统计（SIGUSR1）并读取其中的计数
+static bool read_stress_stats(int pid, const std::string& dir, std::unordered_map<std::string, long long>& stats) {
+    std::string stats_file = dir + "/" STATS_FILE;
+    struct stat before;
+    if (stat(stats_file.c_str(), &before) == -1) before.st_mtim.tv_sec = before.st_mtim.tv_nsec = 0;
+    if (kill(pid, SIGUSR1) == -1) return false;
+    // 等待统计文件被重写
+    for (int i = 0; i < 50; i++) {
+        usleep(10000);
+        struct stat after;
+        if (stat(stats_file.c_str(), &after) == 0 && (after.st_mtim.tv_sec != before.st_mtim.tv_sec ||
+                                              after.st_mtim.tv_nsec != before.st_mtim.tv_nsec)) {
+            break;
+        }
+    }
+    FILE* file = fopen(stats_file.c_str(), "r");
+    if (!file) return false;
+    stats.clear();
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        char* eq = strchr(line, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        stats[line] = atoll(eq + 1);
+    }
+    fclose(file);
+    return !stats.empty();
+}
+
+// 删除被测实例的数据目录（配置、脚本、统计、PID文件、飞行记录与日志，只有一层子目录）
+static void remove_stress_dir(const std::string& dir) {
+    std::string scripts = dir + "/" SCRIPTS_DIR;
+    for (const std::string& path : { scripts, dir }) {
+        DIR* d = opendir(path.c_str());
+        if (!d) continue;
+        while (struct dirent* entry = readdir(d)) {
+            if (entry->d_type != DT_DIR) unlinkat(dirfd(d), entry->d_name, 0);
+        }
+        closedir(d);
+    }
+    rmdir(scripts.c_str());
+    rmdir(dir.c_str());
+}
+
+// 以数据目录中的配置与该数据目录启动被测实例，等待1秒确认其未在启动时退出；失败返回-1
+static pid_t start_test_instance(const std::string& dir) {
+    std::string config = dir + "/" STRESS_CONFIG;
+    pid_t pid = fork();
+    if (pid == 0) {
+        char self[] = "/proc/self/exe";
+        char* argv[] = { self, &config[0], nullptr };
+        setenv(DATA_DIR_ENV, dir.c_str(), 1);
+        execv(self, argv);
+        _exit(127);
+    }
+    if (pid == -1) {
+        fprintf(stderr, "fork failed: %s\n", strerror(errno));
+        return -1;
+    }
+    usleep(1000000);
+    int status = 0;
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+        fprintf(stderr, "kctrl under test exited at startup (status %d), see logcat\n", status);
+        return -1;
+    }
+    return pid;
+}
+
+// 判断某项指标在后一半采样中是否相对前一半持续增长
+static bool stress_grows(const std::vector<StressSample>& samples, size_t begin, int metric) {
+    const auto& check = g_stress_checks[metric];
+    size_t mid = begin + (samples.size() - begin) / 2;
+    double first_max = 0, second_max = 0, first_sum = 0, second_sum = 0, second_min = -1;
+    for (size_t i = begin; i < samples.size(); i++) {
+        double v = samples[i].values[metric];
+        if (i < mid) {
+            first_max = std::max(first_max, v);
+            first_sum += v;
+        } else {
+            second_max = std::max(second_max, v);
+            second_sum += v;
+            second_min = (second_min < 0) ? v : std::min(second_min, v);
+        }
+    }
+    if (check.exact) return second_max > first_max;
+    double first_mean = first_sum / (mid - begin);
+    double second_mean = second_sum / (samples.size() - mid);
+    return second_mean > first_mean * (1 + check.ratio) + check.slack && second_min > first_max;
+}
+
+static int stress_run(double seconds, int devices, double rate, const char* mix) {
+    // 手势比例：click:4,double:2,short:2,long:1
+    int weights[GESTURE_TYPE_COUNT] = { 4, 2, 2, 1 };
+    if (mix && *mix) {
+        static const char* names[GESTURE_TYPE_COUNT] = { "click", "double", "short", "long" };
+        memset(weights, 0, sizeof(weights));
+        std::string_view rest(mix);
+        while (!rest.empty()) {
+            size_t comma = rest.find(',');
+            std::string_view item = sv_trim(rest.substr(0, comma));
+            rest = (comma == std::string_view::npos) ? std::string_view() : rest.substr(comma + 1);
+            size_t colon = item.find(':');
+            std::string_view name = item.substr(0, colon);
+            int weight = (colon == std::string_view::npos) ? 1 : sv_to_int(item.substr(colon + 1), -1);
+            int gesture = -1;
+            for (int i = 0; i < GESTURE_TYPE_COUNT; i++) {
+                if (name == names[i]) gesture = i;
+            }
+            if (gesture < 0 || weight < 0) {
+                fprintf(stderr, "Bad gesture mix item: %.*s\n", (int)item.size(), item.data());
+                return 1;
+            }
+            weights[gesture] = weight;
+        }
+    }
+    int weight_total = 0;
+    for (int w : weights) weight_total += w;
+    if (weight_total == 0) {
+        fprintf(stderr, "Gesture mix is empty\n");
+        return 1;
+    }
+    devices = std::min(std::max(devices, 1), STRESS_MAX_DEVICES);
+    
+    // 被测实例使用独立的数据目录，不做单实例检查，这里检查正在运行的kctrl：两者同时运行时它可能也在监听压力设备
+    int running = read_pid_file();
+    if (running > 0 && kill(running, 0) == 0) {
+        fprintf(stderr, "kctrl is running (pid %d), stop it first\n", running);
+        return 1;
+    }
+    std::string dir = data_path(STRESS_DIR);
+    if (!mkdtemp(&dir[0])) {
+        fprintf(stderr, "Failed to create %s: %s\n", dir.c_str(), strerror(errno));
+        return 1;
+    }
+    
+    std::vector<StressDevice> pool;
+    for (int i = 0; i < devices; i++) {
+        int fd = create_stress_device(i);
+        if (fd == -1) {
+            fprintf(stderr, "Failed to create uinput device: %s\n", strerror(errno));
+            for (auto& dev : pool) close(dev.fd);
+            remove_stress_dir(dir);
+            return 1;
+        }
+        StressDevice dev;
+        memset(&dev, 0, sizeof(dev));
+        dev.fd = fd;
+        pool.push_back(dev);
+    }
+    auto teardown = [&pool, &dir]() {
+        for (auto& dev : pool) {
+            ioctl(dev.fd, UI_DEV_DESTROY);
+            close(dev.fd);
+        }
+        remove_stress_dir(dir);
+    };
+    if (!write_stress_config(dir, devices)) {
+        fprintf(stderr, "Failed to write stress config in %s: %s\n", dir.c_str(), strerror(errno));
+        teardown();
+        return 1;
+    }
+    usleep(200000);  // 等待设备节点出现
+    
+    pid_t pid = start_test_instance(dir);
+    if (pid == -1) {
+        teardown();
+        return 1;
+    }
+    int status = 0;
+    
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stress_signal;  // 不带SA_RESTART，睡眠被中断后立即检查停止标志
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    
+    double interval = std::min(std::max(seconds / 120.0, 1.0), 60.0);
+    printf("Stress: %d device(s), %.1f gesture(s)/s each, mix click:%d double:%d short:%d long:%d, %.0fs, pid %d\n",
+           devices, rate, weights[0], weights[1], weights[2], weights[3], seconds, pid);
+    printf("%8s %7s %5s %8s %5s %5s %9s %10s %10s\n", "TIME_S", "THREADS", "FDS", "RSS_KB", "KEYS",
+           "QUEUE", "GESTURES", "LAT_US", "WAIT_US");
+    fflush(stdout);
+    
+    uint64_t seed = monotonic_ns() | 1;
+    uint64_t begin_ns = monotonic_ns();
+    uint64_t end_ns = begin_ns + static_cast<uint64_t>(seconds * 1e9);
+    uint64_t next_sample_ns = begin_ns + static_cast<uint64_t>(interval * 1e9);
+    for (auto& dev : pool) dev.next_ns = begin_ns + stress_random(seed) % 100000000ULL;
+    
+    std::vector<StressSample> samples;
+    std::unordered_map<std::string, long long> stats;
+    long long last_gestures = 0, last_latency_us = 0, last_started = 0, last_wait_us = 0;
+    uint64_t injected = 0, write_errors = 0;
+    bool child_died = false;
+    while (!g_stress_stop) {
+        uint64_t now_ns = monotonic_ns();
+        if (now_ns >= end_ns) break;
+        
+        if (now_ns >= next_sample_ns) {
+            next_sample_ns += static_cast<uint64_t>(interval * 1e9);
+            ProcessSample process;
+            if (!sample_process(pid, process) || !read_stress_stats(pid, dir, stats)) {
+                child_died = true;
+                break;
+            }
+            StressSample s;
+            s.t = (now_ns - begin_ns) / 1e9;
+            s.values[STRESS_THREADS] = static_cast<double>(process.tasks.size());
+            s.values[STRESS_FDS] = process.fd_count;
+            s.values[STRESS_RSS_KB] = process.rss_kb;
+            s.values[STRESS_KEY_STATES] = static_cast<double>(stats["key_states"]);
+            s.values[STRESS_QUEUE_DEPTH] = static_cast<double>(stats["action_queue_depth"]);
+            long long gestures = stats["gestures"], latency_us = stats["gesture_latency_total_us"];
+            long long started = stats["action_started"], wait_us = stats["action_wait_total_us"];
+            s.values[STRESS_GESTURE_LATENCY_US] = (gestures > last_gestures) ?
+                static_cast<double>(latency_us - last_latency_us) / (gestures - last_gestures) : 0;
+            s.values[STRESS_ACTION_WAIT_US] = (started > last_started) ?
+                static_cast<double>(wait_us - last_wait_us) / (started - last_started) : 0;
+            last_gestures = gestures;
+            last_latency_us = latency_us;
+            last_started = started;
+            last_wait_us = wait_us;
+            samples.push_back(s);
+            printf("%8.0f %7.0f %5.0f %8.0f %5.0f %5.0f %9lld %10.0f %10.0f\n", s.t, s.values[STRESS_THREADS],
+                   s.values[STRESS_FDS], s.values[STRESS_RSS_KB], s.values[STRESS_KEY_STATES],
+                   s.values[STRESS_QUEUE_DEPTH], gestures, s.values[STRESS_GESTURE_LATENCY_US],
+                   s.values[STRESS_ACTION_WAIT_US]);
+            fflush(stdout);
+            continue;
+        }
+        
+        // 注入最早到期的设备的下一步
+        StressDevice* due = &pool[0];
+        for (auto& dev : pool) {
+            if (dev.next_ns < due->next_ns) due = &dev;
+        }
+        uint64_t wake_ns = std::min(std::min(due->next_ns, next_sample_ns), end_ns);
+        if (wake_ns > now_ns) {
+            struct timespec ts;
+            ts.tv_sec = wake_ns / 1000000000ULL;
+            ts.tv_nsec = wake_ns % 1000000000ULL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+            continue;
+        }
+        
+        StressDevice& dev = *due;
+        if (dev.step == 0) {
+            // 开始新手势：按比例选择手势，在该设备的按键中随机选择一个
+            int pick = static_cast<int>(stress_random(seed) % weight_total);
+            dev.gesture = 0;
+            while (pick >= weights[dev.gesture]) pick -= weights[dev.gesture++];
+            int index = static_cast<int>(&dev - pool.data());
+            dev.key = static_cast<uint16_t>(KEY_MACRO1 + index * STRESS_KEYS_PER_DEVICE +
+                                            stress_random(seed) % STRESS_KEYS_PER_DEVICE);
+            dev.start_ns = now_ns;
+        }
+        if (!stress_emit(dev.fd, dev.key, (dev.step % 2 == 0) ? 1 : 0)) write_errors++;
+        injected++;
+        const auto& plan = g_stress_plans[dev.gesture];
+        if (++dev.step < plan.steps) {
+            dev.next_ns = now_ns + plan.delays[dev.step] * 1000000ULL;
+        } else {
+            // 手势结束：按泊松到达安排下一个手势，且至少间隔一个双击窗口，避免与上一手势合并
+            dev.step = 0;
+            double u = (stress_random(seed) % 1000000 + 1) / 1000001.0;
+            uint64_t arrival_ns = dev.start_ns + static_cast<uint64_t>(-log(u) / rate * 1e9);
+            dev.next_ns = std::max<uint64_t>(arrival_ns, now_ns + (STRESS_DOUBLE_MS + 50) * 1000000ULL);
         }
     }
     
-    // 等待所有监听线程结束
-    for (auto& thread : monitor_threads) {
-        if (thread.joinable()) {
-            thread.join();
+    // 停止被测实例
+    bool clean_exit = false;
+    if (!child_died && waitpid(pid, &status, WNOHANG) == 0) {
+        kill(pid, SIGTERM);
+        for (int i = 0; i < 500 && waitpid(pid, &status, WNOHANG) == 0; i++) usleep(10000);
+        if (waitpid(pid, &status, WNOHANG) == 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+        } else {
+            clean_exit = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+    } else {
+        child_died = true;
+        waitpid(pid, &status, 0);
+    }
+    teardown();
+    
+    printf("\ninjected: %llu event(s), %llu write error(s)\n", (unsigned long long)injected,
+           (unsigned long long)write_errors);
+    if (!stats.empty()) {
+        printf("actions: %lld enqueued, %lld dropped, %lld evicted, peak queue %lld; latency max %lldus, wait max %lldus\n",
+               stats["action_enqueued"], stats["action_dropped"], stats["action_evicted"],
+               stats["action_queue_peak"], stats["gesture_latency_max_us"], stats["action_wait_max_us"]);
+    }
+    
+    bool pass = !child_died;
+    if (child_died) printf("kctrl under test died (status %d): FAIL\n", status);
+    else if (!clean_exit) printf("kctrl under test did not exit cleanly (status %d)\n", status);
+    
+    // 前10%（至少2个）采样视为预热，其余分两半比较
+    size_t warmup = std::max<size_t>(2, samples.size() / 10);
+    if (samples.size() < warmup + 4) {
+        printf("too few samples (%zu) to judge growth, run longer\n", samples.size());
+    } else {
+        for (int metric = 0; metric < STRESS_METRIC_COUNT; metric++) {
+            bool grows = stress_grows(samples, warmup, metric);
+            printf("%-16s %s\n", g_stress_checks[metric].name, grows ? "GROWING" : "stable");
+            if (grows) pass = false;
+        }
+    }
+    printf("stress: %s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 4;
+}
+
+// 内存预算检查：kctrl --memcheck [预算KB] [秒数]
+// 在临时数据目录中以压力测试的配置（单个uinput设备、四种手势都绑定空脚本）启动一个kctrl，
+// 每种手势注入一次后等待稳定，按smaps汇总RSS与预算比较；预算缺省取配置中的memory_budget_kb，
+// 超出预算以3退出，无法完成检查（无预算、已有实例运行、被测实例退出等）以1退出
+static int memcheck_run(long budget_kb, double settle_seconds) {
+    if (budget_kb <= 0) {
+        CompiledConfig* cfg = compile_config_file(g_config_path.c_str(), false);
+        budget_kb = cfg ? sv_to_int(config_get(cfg, "memory_budget_kb"), 0) : 0;
+        destroy_config(cfg);
+    }
+    if (budget_kb <= 0) {
+        fprintf(stderr, "No memory budget: pass one or set memory_budget_kb in %s\n", g_config_path.c_str());
+        return 1;
+    }
+    int running = read_pid_file();
+    if (running > 0 && kill(running, 0) == 0) {
+        fprintf(stderr, "kctrl is running (pid %d), stop it first\n", running);
+        return 1;
+    }
+    std::string dir = data_path(STRESS_DIR);
+    if (!mkdtemp(&dir[0])) {
+        fprintf(stderr, "Failed to create %s: %s\n", dir.c_str(), strerror(errno));
+        return 1;
+    }
+    int ufd = create_stress_device(0);
+    if (ufd == -1) {
+        fprintf(stderr, "Failed to create uinput device: %s\n", strerror(errno));
+        remove_stress_dir(dir);
+        return 1;
+    }
+    auto teardown = [ufd, &dir]() {
+        ioctl(ufd, UI_DEV_DESTROY);
+        close(ufd);
+        remove_stress_dir(dir);
+    };
+    if (!write_stress_config(dir, 1)) {
+        fprintf(stderr, "Failed to write memcheck config in %s: %s\n", dir.c_str(), strerror(errno));
+        teardown();
+        return 1;
+    }
+    usleep(200000);  // 等待设备节点出现
+    pid_t pid = start_test_instance(dir);
+    if (pid == -1) {
+        teardown();
+        return 1;
+    }
+    
+    // 每种手势各一次，让识别、分发、动作线程与脚本执行路径都分配过内存
+    for (int gesture = 0; gesture < GESTURE_TYPE_COUNT; gesture++) {
+        const auto& plan = g_stress_plans[gesture];
+        for (int step = 0; step < plan.steps; step++) {
+            usleep(plan.delays[step] * 1000);
+            stress_emit(ufd, KEY_MACRO1, (step % 2 == 0) ? 1 : 0);
+        }
+        usleep((STRESS_DOUBLE_MS + 50) * 1000);
+    }
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(settle_seconds);
+    ts.tv_nsec = static_cast<long>((settle_seconds - ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+    
+    int status = 0;
+    int result = 1;
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+        fprintf(stderr, "kctrl under test exited during the check (status %d)\n", status);
+    } else {
+        result = memstats_report(pid, budget_kb);
+        kill(pid, SIGTERM);
+        for (int i = 0; i < 300 && waitpid(pid, &status, WNOHANG) == 0; i++) usleep(10000);
+        if (waitpid(pid, &status, WNOHANG) == 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+        }
+    }
+    teardown();
+    printf("memcheck: %s\n", result == 0 ? "PASS" : "FAIL");
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    const char* data_dir = getenv(DATA_DIR_ENV);
+    if (data_dir && *data_dir) {
+        g_data_dir = data_dir;
+        g_config_path = data_path("config.txt");
+    }
+    
+    // 解码飞行记录：kctrl --flight-dump [秒数] [文件]
+    if (argc > 1 && strcmp(argv[1], "--flight-dump") == 0) {
+        double seconds = (argc > 2) ? atof(argv[2]) : 60.0;
+        return flight_dump((argc > 3) ? argv[3] : data_path(FLIGHT_FILE).c_str(), seconds > 0 ? seconds : 60.0);
+    }
+    
+    // 切换配置方案：kctrl --profile <名称>
+    if (argc > 2 && strcmp(argv[1], "--profile") == 0) {
+        return send_control_command("profile", argv[2]);
+    }
+    
+    // 无中断升级：kctrl --upgrade [新二进制]
+    if (argc > 1 && strcmp(argv[1], "--upgrade") == 0) {
+        return send_upgrade_command((argc > 2) ? argv[2] : nullptr);
+    }
+    
+    // 空闲开销报告：kctrl --idle-report [秒数] [pid]
+    if (argc > 1 && strcmp(argv[1], "--idle-report") == 0) {
+        double seconds = (argc > 2) ? atof(argv[2]) : 60.0;
+        return idle_report(seconds > 0 ? seconds : 60.0, (argc > 3) ? atoi(argv[3]) : 0);
+    }
+    
+    // 内存预算检查：kctrl --memcheck [预算KB] [秒数]
+    if (argc > 1 && strcmp(argv[1], "--memcheck") == 0) {
+        double seconds = (argc > 3) ? atof(argv[3]) : 5.0;
+        return memcheck_run((argc > 2) ? atol(argv[2]) : 0, seconds > 0 ? seconds : 5.0);
+    }
+    
+    // 内存统计：kctrl --memstats [pid] [预算KB]
+    if (argc > 1 && strcmp(argv[1], "--memstats") == 0) {
+        return memstats_report((argc > 2) ? atoi(argv[2]) : 0, (argc > 3) ? atol(argv[3]) : -1);
+    }
+    
+    // 压力/浸泡测试：kctrl --stress [秒数] [设备数] [每设备每秒手势数] [手势比例]
+    if (argc > 1 && strcmp(argv[1], "--stress") == 0) {
+        double seconds = (argc > 2) ? atof(argv[2]) : 600.0;
+        double rate = (argc > 4) ? atof(argv[4]) : 2.0;
+        return stress_run(seconds > 0 ? seconds : 600.0, (argc > 3) ? atoi(argv[3]) : 4,
+                          rate > 0 ? rate : 2.0, (argc > 5) ? argv[5] : nullptr);
+    }
+    
+    // 配置解析基准：kctrl --bench-config [绑定条数]
+    if (argc > 1 && strcmp(argv[1], "--bench-config") == 0) {
+        int bindings = (argc > 2) ? atoi(argv[2]) : 10000;
+        return bench_config(bindings > 0 ? bindings : 10000);
+    }
+    
+    // 手势引擎基准：kctrl --bench-gesture [事件数]
+    if (argc > 1 && strcmp(argv[1], "--bench-gesture") == 0) {
+        long events = (argc > 2) ? atol(argv[2]) : 1000000;
+        return bench_gesture(events > 0 ? events : 1000000);
+    }
+    
+    // 由旧进程启动的接管模式：kctrl --takeover <交接fd> [配置文件]
+    int handoff_fd = -1;
+    if (argc > 2 && strcmp(argv[1], "--takeover") == 0) {
+        handoff_fd = atoi(argv[2]);
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    g_argv0 = argv[0];
+    open_ready_fd();
+    
+    LOGI("KCTRL v2.4 starting...");
+    LOGI("Author: IDlike");
+    LOGI("Description: 适用于Android15+的按键控制模块");
+    
+    // 信号经signalfd在事件循环中处理；须在创建任何线程之前屏蔽，子线程继承该掩码
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGTERM);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &signal_mask, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    
+    // 系统资源优化设置
+    // 1. 调度策略与CPU亲和性按线程角色在加载配置文件后设置
+    
+    // 2. 确保内存不被锁定，允许系统将进程内存交换到swap
+    munlockall();
+    
+    // 检查单实例运行（接管模式下旧进程仍在运行，交接完成后再写入PID文件）
+    if (handoff_fd == -1 && !check_single_instance()) {
+        LOGE("Another instance is already running");
+        return 1;
+    }
+    
+    // 打开WakeLock接口（不再常驻持有，仅在手势窗口与动作执行期间加锁）
+    if (!open_wakelock_interface()) {
+        LOGW("Wake locks unavailable, relying on EPOLLWAKEUP only");
+    }
+    
+    // 加载配置文件
+    if (argc > 1) g_config_path = argv[1];
+    const char* config_file = g_config_path.c_str();
+    if (!load_config(config_file)) {
+        LOGE("Failed to load config file");
+        cleanup();
+        return 1;
+    }
+    
+    // 可选的trace_marker区间标记（trace_marker=1 开启，需重启生效）
+    if (sv_to_int(config_get("trace_marker")) != 0) {
+        trace_open();
+    }
+    
+    // 设置线程角色调度（在加载配置文件后）
+    // 输入/手势线程默认nice=0，动作线程默认nice=10；亲和性默认沿用cpu_affinity（缺省CPU0）
+    parse_sched_role(g_input_role, "Input", "input", SCHED_OTHER, 0);
+    parse_sched_role(g_action_role, "Action", "action", SCHED_OTHER, 10);
+    apply_sched_role(g_input_role);
+    
+    int action_threads = sv_to_int(config_get("action_threads"), 2);
+    start_action_workers(action_threads);
+    
+    // 获取要监听的设备路径（接管模式下沿用旧进程已打开的设备，不重新枚举）
+    std::vector<std::string> device_paths;
+    if (handoff_fd == -1) {
+        std::string_view device_value = config_get("device");
+        if (device_value.empty()) {
+            LOGE("No device specified in config file");
+            cleanup();
+            return 1;
+        }
+
+        std::string devices_config(device_value);
+        LOGI("Device config: %s", devices_config.c_str());
+
+        // 新增：支持通过设备名称/通配符解析为实际路径
+        device_paths = resolve_device_config(devices_config);
+
+        if (device_paths.empty()) {
+            LOGE("No valid device paths found");
+            cleanup();
+            return 1;
+        }
+
+        LOGI("Found %zu device(s) to monitor", device_paths.size());
+        for (const auto& path : device_paths) {
+            LOGI("Target device: %s", path.c_str());
+        }
+    }
+
+    // 单线程事件循环：输入设备、双击定时器、配置监听与信号统一由epoll处理
+    // 输入设备与定时器使用EPOLLWAKEUP，内核仅在事件待处理期间持有唤醒源
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    g_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int signal_fd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    int inotify_fd = setup_config_watch();
+    int control_fd = (handoff_fd == -1) ? setup_control_socket() : -1;  // 接管时沿用旧进程的套接字
+    g_epoll_fd = epoll_fd;
+    g_inotify_fd = inotify_fd;
+    if (epoll_fd == -1 || g_timer_fd == -1 || signal_fd == -1) {
+        LOGE("Failed to set up event loop: %s", strerror(errno));
+        cleanup();
+        return 1;
+    }
+    
+    // epoll数据中的标识：设备使用其下标，其余使用以下保留值
+    const uint32_t TAG_SIGNAL = 0xFFFFFFF0u;
+    const uint32_t TAG_TIMER = 0xFFFFFFF1u;
+    const uint32_t TAG_INOTIFY = 0xFFFFFFF2u;
+    const uint32_t TAG_CONTROL = 0xFFFFFFF3u;
+    auto epoll_add = [epoll_fd](int fd, uint32_t tag, uint32_t events) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.u32 = tag;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            LOGE("epoll_ctl failed for fd %d: %s", fd, strerror(errno));
+            return false;
+        }
+        return true;
+    };
+    epoll_add(signal_fd, TAG_SIGNAL, EPOLLIN);
+    epoll_add(g_timer_fd, TAG_TIMER, EPOLLIN | EPOLLWAKEUP);
+    if (inotify_fd != -1) epoll_add(inotify_fd, TAG_INOTIFY, EPOLLIN);
+    if (control_fd != -1) epoll_add(control_fd, TAG_CONTROL, EPOLLIN);
+    sync_state_watches();  // 首次加载配置时事件循环尚未建立，在此注册状态监视
+    
+    std::vector<InputDevice> devices;
+    size_t opened_devices = 0;
+    uint32_t inherited_actions = 0;  // 旧进程中仍在执行的动作，代为持有动作唤醒锁直到旧进程退出
+    if (handoff_fd != -1) {
+        // 接管：fd、独占与uinput设备保持不变，交接期间到达的事件留在内核缓冲区中，不会丢失
+        if (!receive_handoff(handoff_fd, devices, control_fd, inherited_actions)) {
+            cleanup();
+            return 1;
+        }
+        for (size_t i = 0; i < devices.size(); i++) {
+            if (epoll_add(devices[i].fd, static_cast<uint32_t>(i), EPOLLIN | EPOLLWAKEUP)) opened_devices++;
+        }
+        if (control_fd != -1) epoll_add(control_fd, TAG_CONTROL, EPOLLIN);
+        for (uint32_t i = 0; i < inherited_actions; i++) wake_source_acquire(g_action_wake);
+        g_gestures.rearm();
+        g_gestures.update_busy();
+        write_pid_file();
+        notify_ready();  // 先于确认：旧进程收到确认即退出，监护进程须已知道新pid
+        if (send(handoff_fd, "OK", 2, MSG_NOSIGNAL) != 2) {
+            // 旧进程已超时并恢复服务，设备仍归它所有
+            LOGE("Takeover: old process is gone before acknowledgement");
+            g_handed_off = true;
+            g_wake_detached = true;
+            for (auto& dev : devices) close_input_device(dev);
+            cleanup();
+            return 1;
+        }
+        epoll_add(handoff_fd, TAG_HANDOFF, EPOLLIN);
+        g_handoff_fd = handoff_fd;
+    } else {
+        devices.resize(device_paths.size());
+        for (size_t i = 0; i < device_paths.size(); i++) {
+            devices[i].path = device_paths[i];
+            devices[i].slot = static_cast<uint16_t>(i);
+            if (!open_input_device(devices[i])) continue;
+            if (!epoll_add(devices[i].fd, static_cast<uint32_t>(i), EPOLLIN | EPOLLWAKEUP)) {
+                close_input_device(devices[i]);
+                continue;
+            }
+            opened_devices++;
+        }
+    }
+    if (opened_devices == 0) {
+        LOGE("No input device could be opened");
+        cleanup();
+        return 1;
+    }
+    
+    // 打开飞行记录器（flight_recorder_kb=0 关闭）
+    // 接管模式下在交接完成后才打开，旧进程此时已停止写入同一文件
+    size_t flight_kb = 64;
+    if (config_has(g_cfg, "flight_recorder_kb")) {
+        flight_kb = static_cast<size_t>(sv_to_int(config_get("flight_recorder_kb")));
+    }
+    if (flight_kb > 0) {
+        flight_open(data_path(FLIGHT_FILE).c_str(), flight_kb * 1024 / sizeof(FlightRecord));
+    }
+    if (handoff_fd == -1) notify_ready();  // 设备已接入，监护进程与启动方可以认为启动完成
+    
+    // 主循环 - 无事件时无限期阻塞在epoll_wait，空闲时没有任何周期性唤醒
+    // （可用 kctrl --idle-report 验证）
+    struct epoll_event events[16];
+    while (g_running) {
+        int n = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            LOGE("epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        
+        g_loop_wakeups++;
+        for (int i = 0; i < n; i++) {
+            uint32_t tag = events[i].data.u32;
+            if (tag == TAG_SIGNAL) {
+                struct signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                    if (info.ssi_signo == SIGUSR1) {
+                        dump_stats();
+                    } else {
+                        LOGI("Received signal %u, shutting down...", info.ssi_signo);
+                        g_running = false;
+                    }
+                }
+            } else if (tag == TAG_TIMER) {
+                handle_click_timer();
+            } else if (tag == TAG_INOTIFY) {
+                handle_config_watch(inotify_fd);
+            } else if (tag == TAG_CONTROL) {
+                handle_control_socket(control_fd);
+            } else if (tag == TAG_HANDOFF) {
+                if (g_handoff_pid > 0) {
+                    // 旧进程：新进程已就绪，交接成功后本轮剩余的设备事件留给新进程
+                    if (complete_upgrade(devices, control_fd)) break;
+                } else {
+                    // 新进程：旧进程已退出，释放代为持有的动作唤醒锁
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, g_handoff_fd, nullptr);
+                    close(g_handoff_fd);
+                    g_handoff_fd = -1;
+                    for (; inherited_actions > 0; inherited_actions--) wake_source_release(g_action_wake);
+                    LOGI("Takeover: old process exited");
+                }
+            } else if ((tag & 0xFFFF0000u) == TAG_STATE_BASE) {
+                handle_state_poll(tag & 0xFFFFu);
+            } else if (tag < devices.size()) {
+                if (!handle_device_input(devices[tag])) {
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, devices[tag].fd, nullptr);
+                    close_input_device(devices[tag]);
+                }
+            }
+        }
+        if (g_upgrade_requested && g_running) {
+            g_upgrade_requested = false;
+            begin_upgrade();
         }
     }
     
+    for (auto& dev : devices) {
+        close_input_device(dev);
+    }
+    if (inotify_fd != -1) close(inotify_fd);
+    if (control_fd != -1) close(control_fd);
+    close(signal_fd);
+    close(epoll_fd);
+    
     cleanup();
     LOGI("KCTRL stopped");
     return 0;